@@ -1,6 +1,7 @@
 #!/usr/bin/env ruby
 
 require 'json'
+require 'fileutils'
 
 # test result array (for JSON output)
 @testscores = []
@@ -9,7 +10,7 @@ require 'json'
 
 # SUPPORT FUNCTIONS:
 
-def run_test(test_name, cmd_line, expected_image, error_as_fail=true)
+def run_test(test_name, cmd_line, expected_image, error_as_fail=true, output_image=nil)
 
   # run the picture library on the supplied command line input
   puts "> running: #{test_name}"
@@ -41,7 +42,7 @@ def run_test(test_name, cmd_line, expected_image, error_as_fail=true)
   if(expected_image) then
       
     puts "check final state of output image:"
-    actual_image = cmd_line.split(" ")[1]
+    actual_image = output_image || cmd_line.split(" ")[1]
     system %Q(./picture_compare #{actual_image} test_images/#{expected_image} 2>&1)
     test_success = $?.exitstatus == 0
     
@@ -99,10 +100,69 @@ else
   
   run_test("blur test 1", "test_images/test.jpg test_blur.jpg blur", "test_blur.jpeg")
   run_test("blur test 2", "test_images/dip.jpg blip.jpg blur", "blip.jpeg")
+  run_test("blur radius 1 test", "test_images/test.jpg test_blur_r1.jpg blur 1", "test_blur.jpeg")
   run_test("repeated blur test 1", "test_images/ducks2.jpg need_glasses1.jpg blur", "need_glasses1.jpeg")
   for blur_cnt in 2..10
     run_test("repeated blur test #{blur_cnt}", "need_glasses#{blur_cnt-1}.jpg need_glasses#{blur_cnt}.jpg blur", "need_glasses#{blur_cnt}.jpeg")  
   end
+  run_test("fused repeated blur test 1", "test_images/test.jpg fused_blur_1.jpg repeated-blur 1", "test_blur.jpeg")
+  run_test("fused repeated blur test 10", "test_images/test.jpg fused_blur_10.jpg repeated-blur 10", "test_10_blurs.jpeg")
+  run_test("pointwise invert test", "test_images/test.jpg pointwise_invert.jpg pointwise invert", "test_inverted.jpeg")
+  run_test("pointwise grayscale test", "test_images/test.jpg pointwise_grayscale.jpg pointwise grayscale", "test_grayscale.jpeg")
+  run_test("pointwise chain test", "test_images/test.jpg pointwise_chain.jpg pointwise invert,invert,grayscale", "test_grayscale.jpeg")
+  run_test("lookup table identity chain test", "test_images/test.jpg lut_chain.jpg pointwise brightness:0,invert,contrast:100,gamma:1,levels:0:255", "test_inverted.jpeg")
+  run_test("lookup table brightness test", "test_images/test.jpg lut_brightness.jpg brightness 40", "test_brightness_40.jpeg")
+  run_test("lookup table contrast test", "test_images/test.jpg lut_contrast.jpg contrast 150", "test_contrast_150.jpeg")
+  run_test("lookup table gamma test", "test_images/test.jpg lut_gamma.jpg gamma 2.2", "test_gamma_2_2.jpeg")
+  run_test("lookup table levels test", "test_images/test.jpg lut_levels.jpg levels 16:235", "test_levels_16_235.jpeg")
+  run_test("lookup table threshold test", "test_images/test.jpg lut_threshold.jpg threshold 128", "test_threshold_128.jpeg")
+
+  puts "----------------------------------------"
+  puts "        Chained Process Test Cases      " 
+  puts "----------------------------------------"
+  puts ""    
+
+  run_test("chained single process test", "test_images/test.jpg chain_rotate_90.jpg rotate:90", "test_rotate_90.jpeg")
+  run_test("chained rotations test", "test_images/test.jpg chain_rotate_270.jpg rotate:90,rotate:180", "test_rotate_270.jpeg")
+  run_test("chained full turn test", "test_images/test.jpg chain_full_turn.jpg rotate:90,rotate:90,invert,rotate:90,rotate:90", "test_inverted.jpeg")
+  run_test("chained flips test", "test_images/test.jpg chain_flips.jpg flip:H,flip:V,rotate:180,flip:H", "test_flip_H.jpeg")
+  run_test("chained pointwise test", "test_images/test.jpg chain_pointwise.jpg invert,rotate:90,invert,grayscale", "test_grayscale_rotate_90.jpeg")
+  run_test("chained pointwise rotate test", "test_images/test.jpg chain_grayscale_rotate.jpg grayscale,rotate:90", "test_grayscale_rotate_90.jpeg")
+  run_test("chained blurs test", "test_images/test.jpg chain_blurs.jpg blur,blur,repeated-blur:3,blur,blur,blur,blur,blur", "test_10_blurs.jpeg")
+
+  puts "----------------------------------------"
+  puts "          Batch Mode Test Cases         " 
+  puts "----------------------------------------"
+  puts ""    
+
+  run_test("batch manifest test", "--batch test_files/batch_manifest.txt invert", "test_inverted.jpeg", true, "batch_test.jpg")
+  run_test("batch chain test", "--batch test_files/batch_manifest.txt rotate:180,flip:H", "keep_calm_V.jpeg", true, "batch_keep_calm.jpg")
+  for n in 1..3
+    run_test("batch repeated input test #{n}", "--batch test_files/batch_repeat_manifest.txt invert", "test_inverted.jpeg", true, "batch_repeat_#{n}.jpg")
+  end
+  # a 1 MiB cache holds only one of test.jpg and ducks1.jpg, so each evicts the other
+  ENV["PICTURE_CACHE_MB"] = "1"
+  for n in 1..2
+    run_test("batch cache eviction test #{n}", "--batch test_files/batch_evict_manifest.txt flip V", "test_flip_V.jpeg", true, "batch_evict_test_#{n}.jpg")
+    run_test("batch cache eviction ducks test #{n}", "--batch test_files/batch_evict_manifest.txt flip V", "ducks1_V.jpeg", true, "batch_evict_ducks1_#{n}.jpg")
+  end
+  ENV.delete("PICTURE_CACHE_MB")
+  # the output directory is created by the batch (notes.png is skipped, not a JPEG)
+  FileUtils.rm_rf("batch_dir_out")
+  run_test("batch directory test", "--batch-dir test_files/batch_dir batch_dir_out invert", "test_inverted.jpeg", true, "batch_dir_out/test.jpg")
+  
+  puts "----------------------------------------"
+  puts "      Parallel Transform Test Cases     " 
+  puts "----------------------------------------"
+  puts ""    
+  
+  run_test("parallel invert test", "test_images/test.jpg par-test_inverted.jpg parallel-invert", "test_inverted.jpeg")
+  run_test("parallel grayscale test", "test_images/test.jpg par-test_grayscale.jpg parallel-grayscale", "test_grayscale.jpeg")
+  run_test("parallel rotate 90 test", "test_images/test.jpg par-test_rotate_90.jpg parallel-rotate 90", "test_rotate_90.jpeg")
+  run_test("parallel rotate 180 test", "test_images/test.jpg par-test_rotate_180.jpg parallel-rotate 180", "test_rotate_180.jpeg")
+  run_test("parallel rotate 270 test", "test_images/test.jpg par-test_rotate_270.jpg parallel-rotate 270", "test_rotate_270.jpeg")
+  run_test("parallel flip H test", "test_images/keep_calm.jpg par-keep_calm_H.jpg parallel-flip H", "keep_calm_H.jpeg")
+  run_test("parallel flip V test", "test_images/keep_calm.jpg par-keep_calm_V.jpg parallel-flip V", "keep_calm_V.jpeg")
   
   puts "----------------------------------------"
   puts "        Parallel Blur Test Cases        " 
@@ -135,6 +195,26 @@ else
   
   run_test("flip arg error test", "test_images/test.jpg output.jpg flip O", nil, false)
   
+  run_test("blur radius arg error test", "test_images/test.jpg output.jpg blur 0", nil, false)
+  run_test("repeated blur arg error test", "test_images/test.jpg output.jpg repeated-blur 0", nil, false)
+  run_test("repeated blur missing arg test", "test_images/test.jpg output.jpg repeated-blur", nil, false)
+  run_test("pointwise arg error test", "test_images/test.jpg output.jpg pointwise invert,blur", nil, false)
+  run_test("brightness arg error test", "test_images/test.jpg output.jpg brightness 300", nil, false)
+  run_test("gamma arg error test", "test_images/test.jpg output.jpg gamma 0", nil, false)
+  run_test("levels arg error test", "test_images/test.jpg output.jpg levels 200:100", nil, false)
+  run_test("threshold arg error test", "test_images/test.jpg output.jpg threshold", nil, false)
+  run_test("chained process error test", "test_images/test.jpg output.jpg invert,invrt", nil, false)
+  run_test("chained arg error test", "test_images/test.jpg output.jpg invert,rotate:100", nil, false)
+  run_test("chained missing arg test", "test_images/test.jpg output.jpg invert,rotate", nil, false)
+  run_test("chained missing flip arg test", "test_images/test.jpg output.jpg blur,flip", nil, false)
+  run_test("batch missing input test", "--batch test_files/batch_missing_manifest.txt invert", nil, false)
+  run_test("batch arg error test", "--batch test_files/batch_manifest.txt rotate:100", nil, false)
+  run_test("batch missing arg test", "--batch test_files/batch_manifest.txt rotate,invert", nil, false)
+  run_test("batch same directory test", "--batch-dir test_images test_images invert", nil, false)
+  
+  run_test("parallel rotate arg error test", "test_images/test.jpg output.jpg parallel-rotate 100", nil, false)
+  run_test("parallel flip arg error test", "test_images/test.jpg output.jpg parallel-flip O", nil, false)
+  
   # clean up the files generated by the tests
   system %Q(make clean)
 end
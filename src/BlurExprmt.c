@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
@@ -110,6 +111,7 @@ static void blur_func(void (*partition_func) (struct picture *pic)) {
       gettimeofday(&stop, NULL);
       avg_time += (stop.tv_sec - start.tv_sec) * THOUSAND +
                   (stop.tv_usec - start.tv_usec) / THOUSAND;
+      clear_picture(&pic);
   }
 
   // Compute average time by dividing by number of tests
@@ -199,6 +201,110 @@ static void blur_pixel(struct pic_info *info) {
   set_pixel(pic, i, j, &pixel);
 }
 
+/* =============THREAD POOL FUNCTIONS============= */
+
+// Initalise a thread pool by assigning basic members
+static bool thread_pool_init(struct t_pool *pool) {
+  pool->head = (struct node*) malloc(sizeof(struct node));
+  pool->tail = (struct node*) malloc(sizeof(struct node));
+
+  // Check that neither malloc failed and exit if any did
+  if (pool->head == NULL || pool->tail == NULL) {
+    return false;
+  }
+
+  /* Return a linked list with a head, a tail and no other nodes
+     Ensure that the head can have no node before it and the tail
+     can have no node after. */
+
+  pool->head->prev = NULL;
+  pool->head->next = pool->tail;
+  pool->tail->prev = pool->head;
+  pool->tail->next = NULL;
+
+  return true;
+}
+
+// Create a new node and assign its thread to the thread passed in
+static struct node *create_node(pthread_t thread) {
+  struct node *node = (struct node*) malloc(sizeof(struct node));
+
+  // Check that malloc has not failed and return a NULL node if it has
+  if (node == NULL) {
+    return NULL;
+  }
+
+  node->thread = thread;
+  return node;
+}
+
+// Remove a specified node from the thread pool
+static void remove_node(struct node *node) {
+
+  // Assign the previous node's next node to the current node's next node
+  node->prev->next = node->next;
+
+  // Assign the next node's previous node to the current node's previous node
+  node->next->prev = node->prev;
+}
+
+// Add a thread to a thread pool
+static bool add_thread_to_pool(pthread_t thread, struct t_pool *pool) {
+  struct node *node = create_node(thread);
+
+  // Check if the node is null (malloc failed)
+  if (node == NULL) {
+    return false;
+  }
+
+  // Add node containing thread to the back of the list
+  pool->tail->prev->next = node;
+  node->prev = pool->tail->prev;
+  node->next = pool->tail;
+  pool->tail->prev = node;
+
+  return true;
+}
+
+
+static void threads_join(struct t_pool *pool) {
+  struct node *prev = NULL;
+  struct node *curr = pool->head;
+
+  // Iterate through all threads until hitting a NULL
+  while (curr != NULL) {
+    prev = curr;
+    curr = curr->next;
+
+    // The current node being checked is not the head or tail  
+    if (prev != pool->head && prev != pool->tail) {
+      // Waits for a thread to terminate and then detaches the thread
+      pthread_join(prev->thread, NULL);
+    }
+
+    // Free resources
+    free(prev);
+  }
+}
+
+static void tryjoin_threads(struct t_pool *pool) {
+  struct node *prev = NULL;
+  struct node *curr = pool->head->next;
+
+  // Iterate through all nodes in the pool
+  while (curr != pool->tail) {
+    prev = curr;
+    curr = curr->next;
+
+    // Perform a join and check thread's successful termination
+    if (pthread_tryjoin_np(prev->thread, NULL) == 0) {
+      //Remove the current node being checked from the pool and free it
+      remove_node(prev);
+      free(prev);
+    }
+  }
+}
+
 /* =============THREAD CREATION FUNCTIONS============= */
 
 /* Create a new thread according to specified parameters and passing in a
@@ -293,9 +399,7 @@ static bool new_quarter_thread(pthread_t *thread, struct picture *pic,
 static void parallel_blur_picture(struct picture *pic){
   // make new temporary picture to work in
   struct picture tmp;
-  tmp.img = copy_image(pic->img);
-  tmp.width = pic->width;
-  tmp.height = pic->height;
+  copy_picture(&tmp, pic);
   
   // Initialise thread pool
   struct t_pool pool;
@@ -323,9 +427,7 @@ static void parallel_blur_picture(struct picture *pic){
 /* Blurs the picture by creating a thread for every column. */
 static void col_blur_picture(struct picture *pic) {
   struct picture tmp;
-  tmp.img = copy_image(pic->img);
-  tmp.width = pic->width;
-  tmp.height = pic->height;
+  copy_picture(&tmp, pic);
 
   // Initialise  thread pool.
   struct t_pool pool;
@@ -343,17 +445,14 @@ static void col_blur_picture(struct picture *pic) {
   }
   threads_join(&pool);
 
-  // clean-up the old picture and replace with new picture
+  // clean-up the temporary picture (the blur was written into pic)
   clear_picture(&tmp);
-  overwrite_picture(pic, &tmp);
 }
 
 /* Blurs the picture by creating a thread for every row. */
 static void row_blur_picture(struct picture *pic) {
     struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
+    copy_picture(&tmp, pic);
 
     // Initialise  thread pool.
     struct t_pool pool;
@@ -371,17 +470,14 @@ static void row_blur_picture(struct picture *pic) {
     }
     threads_join(&pool);
 
-    // clean-up the old picture and replace with new picture
+    // clean-up the temporary picture (the blur was written into pic)
     clear_picture(&tmp);
-    overwrite_picture(pic, &tmp);
 }
 
 /* Blurs the picture by creating a thread for every quarter. */
 static void quarter_blur_picture(struct picture *pic) {
     struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
+    copy_picture(&tmp, pic);
 
     // Get important points of the picture
 
@@ -389,7 +485,7 @@ static void quarter_blur_picture(struct picture *pic) {
     int mid_h = tmp.height / 2;
 
     // Creates  arrays for each quarter with the relevant information
-    int q1[4] = {0, 0, mid_w, mid_h};
+    int q1[4] = {1, 1, mid_w, mid_h};
     int q2[4] = {mid_w, 1, tmp.width - 1, mid_h};
     int q3[4] = {1, mid_h, mid_w, tmp.height - 1};
     int q4[4] = {mid_w, mid_h, tmp.width - 1, tmp.height - 1};
@@ -412,9 +508,8 @@ static void quarter_blur_picture(struct picture *pic) {
     }
     threads_join(&pool);
 
-    // clean-up the old picture and replace with new picture
+    // clean-up the temporary picture (the blur was written into pic)
     clear_picture(&tmp);
-    overwrite_picture(pic, &tmp);
 }
 
 
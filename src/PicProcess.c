@@ -1,255 +1,876 @@
 #include "PicProcess.h"
 #include "ThreadPool.h"
+#include "PixelKernels.h"
+#include <string.h>
+#include <math.h>
 
-  #define NO_RGB_COMPONENTS 3
   #define BLUR_REGION_SIZE 9
+  #define TILE_SIZE 64
+  #define MAX_BLUR_RADIUS 2000
+  #define REPEATED_BLUR_TILE_SIZE 128
+  #define SWAP_CHUNK_SIZE 1024
+  #define POINTWISE_SPAN 512
+  #define LUT_ENTRIES 256
+  #define MAX_INTENSITY 255
+  #define MAX_BRIGHTNESS_DELTA 255
+  #define MAX_CONTRAST_PERCENT 1000
+  #define MIN_GAMMA 0.01
+  #define MAX_GAMMA 100.0
 
-  static void blur_pixel(struct pic_info *info);
+  static void blur_span(unsigned char *above, unsigned char *row,
+                        unsigned char *below, unsigned char *out, int width);
+  static void box_blur_region(struct picture *src, struct picture *dst,
+                              int x0, int x1, int y0, int y1);
+  static void mirror_picture(struct picture *pic, bool flip_rows, bool reverse, bool parallel);
+  static void for_each_tile(struct picture *pic, int tile_w, int tile_h,
+          void (*fn)(struct picture *, const struct tile *, void *), void *ctx);
+  static void materialise(struct picture *pic, bool parallel);
+  static void make_writable(struct picture *pic);
+  static void check_angle(struct picture *pic, int angle);
+  static void check_plane(struct picture *pic, char plane);
+  static struct orientation rotation(int angle);
+  static struct orientation mirror(char plane);
 
+  /* Pointwise transformations do not depend on where a pixel is, so they 
+     work on the stored pixels and leave any pending orientation in place. */
   void invert_picture(struct picture *pic){
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < pic->width; i++){
-      for(int j = 0 ; j < pic->height; j++){
-        struct pixel rgb = get_pixel(pic, i, j);
-        
-        // invert RGB values of pixel
-        rgb.red = MAX_PIXEL_INTENSITY - rgb.red;
-        rgb.green = MAX_PIXEL_INTENSITY - rgb.green;
-        rgb.blue = MAX_PIXEL_INTENSITY - rgb.blue;
-        
-        // set pixel to inverted RBG values
-        set_pixel(pic, i, j, &rgb);
-      }
-    }   
+    make_writable(pic);
+
+    // iterate over each row in the picture
+    for(int j = 0 ; j < pic->height; j++){
+      invert_pixels(picture_row(pic, j), pic->width);
+    }
   }
 
   void grayscale_picture(struct picture *pic){
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < pic->width; i++){
-      for(int j = 0 ; j < pic->height; j++){
-        struct pixel rgb = get_pixel(pic, i, j);
-        
-        // compute gray average of pixel's RGB values
-        int avg = (rgb.red + rgb.green + rgb.blue) / NO_RGB_COMPONENTS;
-        rgb.red = avg;
-        rgb.green = avg;
-        rgb.blue = avg;
-        
-        // set pixel to gray-scale RBG value
-        set_pixel(pic, i, j, &rgb);
-      }
-    }    
+    make_writable(pic);
+
+    // iterate over each row in the picture
+    for(int j = 0 ; j < pic->height; j++){
+      grayscale_pixels(picture_row(pic, j), pic->width);
+    }
   }
 
+  // rotations and flips only update the picture's pending orientation; the
+  // pixels are moved once, by the next transformation or save that needs them
   void rotate_picture(struct picture *pic, int angle){
-    // capture current picture size
-    int new_width = pic->width;
-    int new_height = pic->height;
-  
-    // adjust output picture size as necessary
-    if(angle == 90 || angle == 270){
-      new_width = pic->height;
-      new_height = pic->width;
-    }
-    
-    // make new temporary picture to work in
+    check_angle(pic, angle);
+    orient_picture(pic, rotation(angle));
+  }
+
+  void flip_picture(struct picture *pic, char plane){
+    check_plane(pic, plane);
+    orient_picture(pic, mirror(plane));
+  }
+
+  void materialise_picture(struct picture *pic){
+    materialise(pic, false);
+  }
+
+  void blur_picture(struct picture *pic){
+    materialise_picture(pic);
+
+    // make new temporary picture to work in (boundary pixels stay unmodified)
     struct picture tmp;
-    init_picture_from_size(&tmp, new_width, new_height);     
-  
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < new_width; i++){
-      for(int j = 0 ; j < new_height; j++){
-        struct pixel rgb;
-        // determine rotation angle and execute corresponding pixel update
-        switch(angle){
-          case(90):
-            rgb = get_pixel(pic, j, new_width -1 - i); 
-            break;
-          case(180):
-            rgb = get_pixel(pic, new_width - 1 - i, new_height - 1 - j);
-            break;
-          case(270):
-            rgb = get_pixel(pic, new_height - 1 - j, i);
-            break;
-          default:
-            printf("[!] rotate is undefined for angle %i (must be 90, 180 or 270)\n", angle);
-            clear_picture(&tmp);
-            clear_picture(pic);
-            exit(IO_ERROR);
-        }
-        set_pixel(&tmp, i,j, &rgb);
-      }
+    copy_picture(&tmp, pic);
+
+    // blur every interior pixel
+    if(tmp.width > 2 && tmp.height > 2){
+      box_blur_region(pic, &tmp, 1, tmp.width - 1, 1, tmp.height - 1);
     }
-    
+
     // clean-up the old picture and replace with new picture
     clear_picture(pic);
     overwrite_picture(pic, &tmp);
   }
 
-  void flip_picture(struct picture *pic, char plane){
-    // make new temporary picture to work in
-    struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
-    
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < tmp.width; i++){
-      for(int j = 0 ; j < tmp.height; j++){    
-        struct pixel rgb;
-        // determine flip plane and execute corresponding pixel update
-        switch(plane){
-          case('V'):
-            rgb = get_pixel(pic, i, tmp.height - 1 - j);
-            break;
-          case('H'):
-            rgb = get_pixel(pic, tmp.width - 1 - i, j);
-            break;
-          default:
-            printf("[!] flip is undefined for plane %c\n", plane);
-            clear_picture(&tmp);
-            clear_picture(pic);
-            exit(IO_ERROR);
-        } 
-        set_pixel(&tmp, i, j, &rgb);
+// ----------------------------- row kernels ------------------------------ \\
+
+  // write the 3x3 region average of width consecutive pixels in row to out,
+  // where above and below point at the same columns of the adjacent rows
+  static void blur_span(unsigned char *above, unsigned char *row,
+                        unsigned char *below, unsigned char *out, int width){
+    for(int k = 0; k < width * BYTES_PER_PIXEL; k++){
+      int sum = above[k - BYTES_PER_PIXEL] + above[k] + above[k + BYTES_PER_PIXEL]
+              + row[k - BYTES_PER_PIXEL] + row[k] + row[k + BYTES_PER_PIXEL]
+              + below[k - BYTES_PER_PIXEL] + below[k] + below[k + BYTES_PER_PIXEL];
+      out[k] = sum / BLUR_REGION_SIZE;
+    }
+  }
+
+  // swap n bytes between a and b
+  static void swap_bytes(unsigned char *a, unsigned char *b, int n){
+    unsigned char chunk[SWAP_CHUNK_SIZE];
+    for(int k = 0; k < n; k += SWAP_CHUNK_SIZE){
+      int len = n - k < SWAP_CHUNK_SIZE ? n - k : SWAP_CHUNK_SIZE;
+      memcpy(chunk, a + k, len);
+      memcpy(a + k, b + k, len);
+      memcpy(b + k, chunk, len);
+    }
+  }
+
+  // write the sum of each byte and its left and right pixel neighbours into
+  // sums, for the n bytes of row y starting at column x0, using a running sum
+  static void row_sums(struct picture *src, int x0, int y, int n, unsigned short *sums){
+    unsigned char *p = picture_span(src, x0, y);
+    for(int k = 0; k < BYTES_PER_PIXEL && k < n; k++){
+      sums[k] = p[k - BYTES_PER_PIXEL] + p[k] + p[k + BYTES_PER_PIXEL];
+    }
+    for(int k = BYTES_PER_PIXEL; k < n; k++){
+      sums[k] = sums[k - BYTES_PER_PIXEL] + p[k + BYTES_PER_PIXEL] - p[k - 2 * BYTES_PER_PIXEL];
+    }
+  }
+
+  /* Blur the pixels [x0, x1) x [y0, y1) of src into dst, where the region 
+     excludes the picture boundary. The 3x3 region sums are built separably:
+     each row's horizontal sums are computed once with a sliding window, 
+     and a running column total adds the row entering the window and drops 
+     the row leaving it, so every output byte costs O(1) and the integer 
+     result matches the 3x3 stencil exactly. */
+  static void box_blur_region(struct picture *src, struct picture *dst,
+                              int x0, int x1, int y0, int y1){
+    int n = (x1 - x0) * BYTES_PER_PIXEL;
+    unsigned short *sums = malloc(4 * (size_t) n * sizeof(unsigned short));
+
+    // fall back to the direct stencil if there is no scratch memory
+    if(sums == NULL){
+      for(int j = y0; j < y1; j++){
+        blur_span(picture_span(src, x0, j - 1), picture_span(src, x0, j),
+                  picture_span(src, x0, j + 1), picture_span(dst, x0, j), x1 - x0);
       }
+      return;
     }
 
-    // clean-up the old picture and replace with new picture
-    clear_picture(pic);
-    overwrite_picture(pic, &tmp);
+    // horizontal sums of the three rows in the window, plus their total
+    unsigned short *window[3] = { sums, sums + n, sums + 2 * n };
+    unsigned short *column = sums + 3 * n;
+
+    row_sums(src, x0, y0 - 1, n, window[0]);
+    row_sums(src, x0, y0, n, window[1]);
+    for(int k = 0; k < n; k++){
+      column[k] = window[0][k] + window[1][k];
+    }
+
+    for(int j = y0; j < y1; j++){
+      // the row entering the window reuses the slot of the row that left it
+      unsigned short *entering = window[(j - y0 + 2) % 3];
+      unsigned short *leaving = window[(j - y0) % 3];
+      unsigned char *out = picture_span(dst, x0, j);
+
+      row_sums(src, x0, j + 1, n, entering);
+      for(int k = 0; k < n; k++){
+        column[k] += entering[k];
+        out[k] = column[k] / BLUR_REGION_SIZE;
+        column[k] -= leaving[k];
+      }
+    }
+
+    free(sums);
   }
 
-  void blur_picture(struct picture *pic){
-    // make new temporary picture to work in
-    struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
-  
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < tmp.width; i++){
-      for(int j = 0 ; j < tmp.height; j++){
-      
-        // set-up a local pixel on the stack
-        struct pixel rgb = get_pixel(pic, i, j);
-        
-        // don't need to modify boundary pixels
-        if(i != 0 && j != 0 && i != tmp.width - 1 && j != tmp.height - 1){
-        
-          // set up running RGB component totals for pixel region
-          int sum_red = rgb.red;
-          int sum_green = rgb.green;
-          int sum_blue = rgb.blue;
-      
-          // check the surrounding pixel region
-          for(int n = -1; n <= 1; n++){
-            for(int m = -1; m <= 1; m++){
-              if(n != 0 || m != 0){
-                rgb = get_pixel(pic, i+n, j+m);
-                sum_red += rgb.red;
-                sum_green += rgb.green;
-                sum_blue += rgb.blue;
-              }
-            }
-          }
-      
-          // compute average pixel RGB value
-          rgb.red = sum_red / BLUR_REGION_SIZE;
-          rgb.green = sum_green / BLUR_REGION_SIZE;
-          rgb.blue = sum_blue / BLUR_REGION_SIZE;
+// ------------------------ parallel tile helpers ------------------------- \\
+
+  // a single tile of work queued on the thread pool
+  struct tile_task {
+    struct picture *pic;
+    struct tile tile;
+    void (*fn)(struct picture *, const struct tile *, void *);
+    void *ctx;
+  };
+
+  static void run_tile_task(void *arg){
+    struct tile_task *task = (struct tile_task *) arg;
+    task->fn(task->pic, &task->tile, task->ctx);
+  }
+
+  // run fn over every tile of pic in turn on the calling thread
+  static void for_each_tile(struct picture *pic, int tile_w, int tile_h,
+          void (*fn)(struct picture *, const struct tile *, void *), void *ctx){
+    for(int y = 0; y < pic->height; y += tile_h){
+      for(int x = 0; x < pic->width; x += tile_w){
+        struct tile tile;
+        tile.x0 = x;
+        tile.y0 = y;
+        tile.x1 = x + tile_w < pic->width ? x + tile_w : pic->width;
+        tile.y1 = y + tile_h < pic->height ? y + tile_h : pic->height;
+        fn(pic, &tile, ctx);
+      }
+    }
+  }
+
+  void parallel_for_tiles(struct picture *pic, int tile_w, int tile_h,
+          void (*fn)(struct picture *, const struct tile *, void *), void *ctx){
+    // non-positive tile sizes span the whole picture in that direction
+    if(tile_w <= 0 || tile_w > pic->width){
+      tile_w = pic->width;
+    }
+    if(tile_h <= 0 || tile_h > pic->height){
+      tile_h = pic->height;
+    }
+    if(tile_w == 0 || tile_h == 0){
+      return;
+    }
+
+    int cols = (pic->width + tile_w - 1) / tile_w;
+    int rows = (pic->height + tile_h - 1) / tile_h;
+    struct tile_task *tasks = malloc((size_t) cols * rows * sizeof(struct tile_task));
+
+    struct t_pool *pool = shared_thread_pool();
+    struct t_group group;
+    task_group_init(&group);
+
+    // carve the picture into tiles, clipping the last row and column
+    for(int r = 0; r < rows; r++){
+      for(int c = 0; c < cols; c++){
+        struct tile tile;
+        tile.x0 = c * tile_w;
+        tile.y0 = r * tile_h;
+        tile.x1 = tile.x0 + tile_w < pic->width ? tile.x0 + tile_w : pic->width;
+        tile.y1 = tile.y0 + tile_h < pic->height ? tile.y0 + tile_h : pic->height;
+
+        // fall back to running in the caller if there is no task memory
+        if(tasks == NULL){
+          fn(pic, &tile, ctx);
+          continue;
         }
-      
-        // set pixel to computed region RBG value (unmodified if boundary)
-        set_pixel(&tmp, i, j, &rgb);
+        struct tile_task *task = &tasks[r * cols + c];
+        task->pic = pic;
+        task->tile = tile;
+        task->fn = fn;
+        task->ctx = ctx;
+        thread_pool_submit(pool, &group, run_tile_task, task);
       }
     }
-    
+
+    thread_pool_wait(pool, &group);
+    task_group_destroy(&group);
+    free(tasks);
+  }
+
+  static void invert_tile(struct picture *pic, const struct tile *tile, void *unused){
+    for(int j = tile->y0; j < tile->y1; j++){
+      invert_pixels(picture_span(pic, tile->x0, j), tile->x1 - tile->x0);
+    }
+  }
+
+  static void grayscale_tile(struct picture *pic, const struct tile *tile, void *unused){
+    for(int j = tile->y0; j < tile->y1; j++){
+      grayscale_pixels(picture_span(pic, tile->x0, j), tile->x1 - tile->x0);
+    }
+  }
+
+  /* Fill a tile of a picture rotated by a quarter turn: output row y is 
+     source column flip_x ? width-1-y : y, read top to bottom, or bottom to
+     top with flip_y. Reads walk down a source column, so tiles are kept 
+     small enough for the source and destination blocks to stay in cache.
+     flip_x and flip_y are literals in each caller, so every rotation gets 
+     its own loop with no per-pixel branching. */
+  __attribute__((always_inline))
+  static inline void transpose_tile(struct picture *tmp, const struct tile *tile,
+                                    struct picture *pic, const bool flip_x, const bool flip_y){
+    long step = flip_y ? -(long) pic->stride : pic->stride;
+    int sy0 = flip_y ? pic->height - 1 - tile->x0 : tile->x0;
+
+    for(int j = tile->y0; j < tile->y1; j++){
+      int sx = flip_x ? pic->width - 1 - j : j;
+      unsigned char *in = picture_span(pic, sx, sy0);
+      unsigned char *out = picture_span(tmp, tile->x0, j);
+      for(int i = tile->x0; i < tile->x1; i++){
+        memcpy(out, in, BYTES_PER_PIXEL);
+        out += BYTES_PER_PIXEL;
+        in += step;
+      }
+    }
+  }
+
+  static void transpose_plain_tile(struct picture *tmp, const struct tile *tile, void *arg){
+    transpose_tile(tmp, tile, (struct picture *) arg, false, false);
+  }
+
+  static void rotate_90_tile(struct picture *tmp, const struct tile *tile, void *arg){
+    transpose_tile(tmp, tile, (struct picture *) arg, false, true);
+  }
+
+  static void rotate_270_tile(struct picture *tmp, const struct tile *tile, void *arg){
+    transpose_tile(tmp, tile, (struct picture *) arg, true, false);
+  }
+
+  static void transpose_anti_tile(struct picture *tmp, const struct tile *tile, void *arg){
+    transpose_tile(tmp, tile, (struct picture *) arg, true, true);
+  }
+
+  // transpose_tile specialised for each pair of flips, indexed [flip_x][flip_y]
+  static void (* const transpose_tiles[2][2])(struct picture *, const struct tile *, void *) = {
+    {transpose_plain_tile, rotate_90_tile},
+    {rotate_270_tile, transpose_anti_tile}
+  };
+
+  // how mirror_picture pairs up rows and swaps them
+  struct mirror_ctx {
+    struct picture *pic;
+    bool flip_rows;
+    bool reverse;
+  };
+
+  // swap each row in the tile with its partner row, or with itself
+  static void mirror_rows_tile(struct picture *rows, const struct tile *tile, void *arg){
+    struct mirror_ctx *ctx = (struct mirror_ctx *) arg;
+    struct picture *pic = ctx->pic;
+
+    for(int j = tile->y0; j < tile->y1; j++){
+      unsigned char *row = picture_row(pic, j);
+      unsigned char *partner = ctx->flip_rows ? picture_row(pic, pic->height - 1 - j) : row;
+      if(ctx->reverse){
+        reverse_swap_pixels(row, partner, pic->width);
+      } else {
+        swap_bytes(row, partner, pic->width * BYTES_PER_PIXEL);
+      }
+    }
+  }
+
+  /* Mirror a picture in place. flip_rows swaps row y with row height-1-y,
+     and reverse swaps pixel x with pixel width-1-x; both together turn the
+     picture by 180 degrees. Paired rows are only visited from the top half
+     (including the middle row of an odd height, which reverses onto itself)
+     so no temporary picture is needed. */
+  static void mirror_picture(struct picture *pic, bool flip_rows, bool reverse, bool parallel){
+    struct mirror_ctx ctx;
+    ctx.pic = pic;
+    ctx.flip_rows = flip_rows;
+    ctx.reverse = reverse;
+
+    // a view onto the rows that start a swap
+    struct picture rows = *pic;
+    if(flip_rows){
+      rows.height = reverse ? (pic->height + 1) / 2 : pic->height / 2;
+    }
+
+    if(parallel){
+      parallel_for_tiles(&rows, rows.width, TILE_SIZE, mirror_rows_tile, &ctx);
+    } else {
+      for_each_tile(&rows, rows.width, rows.height, mirror_rows_tile, &ctx);
+    }
+  }
+
+  // blur the interior pixels of a tile, reading from the unmodified copy
+  static void blur_tile(struct picture *pic, const struct tile *tile, void *arg){
+    struct picture *tmp = (struct picture *) arg;
+
+    int x0 = tile->x0 > 0 ? tile->x0 : 1;
+    int y0 = tile->y0 > 0 ? tile->y0 : 1;
+    int x1 = tile->x1 < pic->width - 1 ? tile->x1 : pic->width - 1;
+    int y1 = tile->y1 < pic->height - 1 ? tile->y1 : pic->height - 1;
+
+    if(x0 < x1 && y0 < y1){
+      box_blur_region(tmp, pic, x0, x1, y0, y1);
+    }
+  }
+
+// --------------------------- pointwise chains --------------------------- \\
+
+  void init_pointwise_chain(struct pointwise_chain *chain){
+    chain->length = 0;
+  }
+
+  static bool chain_op(struct pointwise_chain *chain,
+                       void (*fn)(unsigned char *, int, const struct channel_lut *), int lut){
+    if(chain->length == MAX_POINTWISE_OPS){
+      return false;
+    }
+    chain->ops[chain->length].fn = fn;
+    chain->ops[chain->length].lut = lut;
+    chain->length++;
+    return true;
+  }
+
+  static void grayscale_op(unsigned char *span, int width, const struct channel_lut *unused){
+    grayscale_pixels(span, width);
+  }
+
+  static void lut_op(unsigned char *span, int width, const struct channel_lut *lut){
+    if(lut->shared){
+      lut_bytes(span, width * BYTES_PER_PIXEL, lut->table[0]);
+    } else {
+      lut_pixels(span, width, lut->table);
+    }
+  }
+
+  // inverting is a lookup table, so it can merge with its neighbours
+  bool chain_invert(struct pointwise_chain *chain){
+    struct channel_lut lut;
+    invert_lut(&lut);
+    return chain_lut(chain, &lut);
+  }
+
+  // a lookup table straight after another is composed into it, so a run of
+  // table operations costs a single lookup per byte
+  bool chain_lut(struct pointwise_chain *chain, const struct channel_lut *lut){
+    int last = chain->length - 1;
+    if(last >= 0 && chain->ops[last].fn == lut_op){
+      compose_lut(&chain->luts[last], lut);
+      return true;
+    }
+    if(chain->length == MAX_POINTWISE_OPS){
+      return false;
+    }
+    chain->luts[chain->length] = *lut;
+    return chain_op(chain, lut_op, chain->length);
+  }
+
+  bool chain_grayscale(struct pointwise_chain *chain){
+    return chain_op(chain, grayscale_op, -1);
+  }
+
+  /* Run the whole chain over short spans of each row, so every operation 
+     after the first finds its pixels still in L1 cache and the picture is 
+     only streamed through memory once. */
+  static void pointwise_tile(struct picture *pic, const struct tile *tile, void *arg){
+    const struct pointwise_chain *chain = (const struct pointwise_chain *) arg;
+    for(int j = tile->y0; j < tile->y1; j++){
+      for(int x = tile->x0; x < tile->x1; x += POINTWISE_SPAN){
+        int width = tile->x1 - x < POINTWISE_SPAN ? tile->x1 - x : POINTWISE_SPAN;
+        unsigned char *span = picture_span(pic, x, j);
+        for(int k = 0; k < chain->length; k++){
+          const struct pointwise_op *op = &chain->ops[k];
+          op->fn(span, width, op->lut < 0 ? NULL : &chain->luts[op->lut]);
+        }
+      }
+    }
+  }
+
+  // pointwise operations ignore pixel position, so any pending orientation
+  // can stay pending
+  void run_pointwise_chain(struct picture *pic, const struct pointwise_chain *chain){
+    if(chain->length == 0){
+      return;
+    }
+    make_writable(pic);
+    parallel_for_tiles(pic, pic->width, TILE_SIZE, pointwise_tile, (void *) chain);
+  }
+
+// ---------------------------- lookup tables ----------------------------- \\
+
+  // clamp an intensity to the range a byte can hold
+  static unsigned char clamp_intensity(long v){
+    return v < 0 ? 0 : v > MAX_INTENSITY ? MAX_INTENSITY : v;
+  }
+
+  // copy the table for the first channel to the others
+  static void share_table(struct channel_lut *lut){
+    for(int c = 1; c < BYTES_PER_PIXEL; c++){
+      memcpy(lut->table[c], lut->table[0], LUT_ENTRIES);
+    }
+    lut->shared = true;
+  }
+
+  void invert_lut(struct channel_lut *lut){
+    for(int v = 0; v < LUT_ENTRIES; v++){
+      lut->table[0][v] = MAX_INTENSITY - v;
+    }
+    share_table(lut);
+  }
+
+  // add delta (-255 to 255) to every value
+  bool brightness_lut(struct channel_lut *lut, int delta){
+    if(delta < -MAX_BRIGHTNESS_DELTA || delta > MAX_BRIGHTNESS_DELTA){
+      return false;
+    }
+    for(int v = 0; v < LUT_ENTRIES; v++){
+      lut->table[0][v] = clamp_intensity(v + delta);
+    }
+    share_table(lut);
+    return true;
+  }
+
+  // scale the distance of every value from mid-gray by percent (0 to 1000),
+  // rounding half away from mid-gray
+  bool contrast_lut(struct channel_lut *lut, int percent){
+    if(percent < 0 || percent > MAX_CONTRAST_PERCENT){
+      return false;
+    }
+    int mid = (MAX_INTENSITY + 1) / 2;
+    for(int v = 0; v < LUT_ENTRIES; v++){
+      long scaled = (long) (v - mid) * percent;
+      long offset = scaled >= 0 ? (scaled + 50) / 100 : -((-scaled + 50) / 100);
+      lut->table[0][v] = clamp_intensity(mid + offset);
+    }
+    share_table(lut);
+    return true;
+  }
+
+  // map v to 255 * (v / 255) ^ (1 / gamma); gamma above 1 brightens
+  bool gamma_lut(struct channel_lut *lut, double gamma){
+    if(!(gamma >= MIN_GAMMA && gamma <= MAX_GAMMA)){
+      return false;
+    }
+    for(int v = 0; v < LUT_ENTRIES; v++){
+      double level = pow((double) v / MAX_INTENSITY, 1.0 / gamma);
+      lut->table[0][v] = clamp_intensity(lround(level * MAX_INTENSITY));
+    }
+    share_table(lut);
+    return true;
+  }
+
+  // stretch [black, white] linearly over the full range, clipping outside it
+  bool levels_lut(struct channel_lut *lut, int black, int white){
+    if(black < 0 || black >= white || white > MAX_INTENSITY){
+      return false;
+    }
+    int range = white - black;
+    for(int v = 0; v < LUT_ENTRIES; v++){
+      long stretched = v < black ? 0 : ((long) (v - black) * MAX_INTENSITY + range / 2) / range;
+      lut->table[0][v] = clamp_intensity(stretched);
+    }
+    share_table(lut);
+    return true;
+  }
+
+  // values of level (0 to 255) and above become 255, the rest 0
+  bool threshold_lut(struct channel_lut *lut, int level){
+    if(level < 0 || level > MAX_INTENSITY){
+      return false;
+    }
+    for(int v = 0; v < LUT_ENTRIES; v++){
+      lut->table[0][v] = v >= level ? MAX_INTENSITY : 0;
+    }
+    share_table(lut);
+    return true;
+  }
+
+  void compose_lut(struct channel_lut *lut, const struct channel_lut *then){
+    for(int c = 0; c < BYTES_PER_PIXEL; c++){
+      for(int v = 0; v < LUT_ENTRIES; v++){
+        lut->table[c][v] = then->table[c][lut->table[c][v]];
+      }
+    }
+    lut->shared = lut->shared && then->shared;
+  }
+
+// ------------------------- pending orientations ------------------------- \\
+
+  /* Apply a picture's pending orientation to its pixels in a single pass: a
+     blocked transpose into a new picture when x and y are swapped, otherwise
+     an in-place mirror. Orientations that have cancelled out cost nothing. */
+  static void materialise(struct picture *pic, bool parallel){
+    struct orientation o = pic->orientation;
+    if(!is_oriented(pic)){
+      return;
+    }
+
+    if(!o.transpose){
+      make_writable(pic);
+      mirror_picture(pic, o.flip_y, o.flip_x, parallel);
+      pic->orientation = (struct orientation) {false, false, false};
+      return;
+    }
+
+    // make new temporary picture of the transposed size to work in
+    struct picture tmp;
+    init_picture_from_size(&tmp, pic->height, pic->width);
+
+    void (*fn)(struct picture *, const struct tile *, void *) = transpose_tiles[o.flip_x][o.flip_y];
+    if(parallel){
+      parallel_for_tiles(&tmp, TILE_SIZE, TILE_SIZE, fn, pic);
+    } else {
+      for_each_tile(&tmp, TILE_SIZE, TILE_SIZE, fn, pic);
+    }
+
     // clean-up the old picture and replace with new picture
     clear_picture(pic);
     overwrite_picture(pic, &tmp);
   }
 
-  // Blur an individual pixel (and hence its surrounding area)
-  void blur_pixel(struct pic_info *info) {
-    struct picture *pic = info->pic;
-    struct picture *tmp = info->tmp;
-    int i = info->i;
-    int j = info->j;
-
-    struct pixel pixel;  
-    int total_red = 0;
-    int total_green = 0;
-    int total_blue = 0;
-
-    // Apply loop to area around pixel to check and sum rgb values
-    for(int n = -1; n <= 1; n++){
-      for(int m = -1; m <= 1; m++){
-        pixel = get_pixel(tmp, i + n, j + m);
-        total_red += pixel.red;
-        total_green += pixel.green;
-        total_blue += pixel.blue;
+  // make sure a picture's pixels are its own before writing them in place
+  static void make_writable(struct picture *pic){
+    if(!unshare_picture(pic)){
+      printf("[!] not enough memory to modify picture\n");
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  bool valid_angle(int angle){
+    return angle == 90 || angle == 180 || angle == 270;
+  }
+
+  bool valid_plane(char plane){
+    return plane == 'V' || plane == 'H';
+  }
+
+  bool valid_blur_radius(int radius){
+    return radius >= 1 && radius <= MAX_BLUR_RADIUS;
+  }
+
+  bool valid_blur_passes(int passes){
+    return passes >= 1;
+  }
+
+  static void check_angle(struct picture *pic, int angle){
+    if(!valid_angle(angle)){
+      printf("[!] rotate is undefined for angle %i (must be 90, 180 or 270)\n", angle);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  static void check_plane(struct picture *pic, char plane){
+    if(!valid_plane(plane)){
+      printf("[!] flip is undefined for plane %c\n", plane);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  // orientation of a clockwise turn by a (checked) angle
+  static struct orientation rotation(int angle){
+    switch(angle){
+      case(90):
+        return (struct orientation) {true, false, true};
+      case(180):
+        return (struct orientation) {false, true, true};
+      default:
+        return (struct orientation) {true, true, false};
+    }
+  }
+
+  // orientation of a flip in a (checked) plane
+  static struct orientation mirror(char plane){
+    if(plane == 'H'){
+      return (struct orientation) {false, true, false};
+    }
+    return (struct orientation) {false, false, true};
+  }
+
+// ---------------- parallel picture transformation routines --------------- \\
+
+  void parallel_invert_picture(struct picture *pic){
+    make_writable(pic);
+    parallel_for_tiles(pic, TILE_SIZE, TILE_SIZE, invert_tile, NULL);
+  }
+
+  void parallel_grayscale_picture(struct picture *pic){
+    make_writable(pic);
+    parallel_for_tiles(pic, TILE_SIZE, TILE_SIZE, grayscale_tile, NULL);
+  }
+
+  // parallel rotations and flips take effect immediately, moving the pixels
+  // for any orientation still pending along with them in one pass
+  void parallel_rotate_picture(struct picture *pic, int angle){
+    rotate_picture(pic, angle);
+    parallel_materialise_picture(pic);
+  }
+
+  void parallel_flip_picture(struct picture *pic, char plane){
+    flip_picture(pic, plane);
+    parallel_materialise_picture(pic);
+  }
+
+  void parallel_materialise_picture(struct picture *pic){
+    materialise(pic, true);
+  }
+
+
+  // summed-area table of a picture and the blur radius read from it
+  struct sat_ctx {
+    unsigned int *sums;
+    size_t stride;
+    int radius;
+  };
+
+  // prefix-sum each pixel row into the row below it in the table
+  static void sat_rows_tile(struct picture *pic, const struct tile *tile, void *arg){
+    struct sat_ctx *ctx = (struct sat_ctx *) arg;
+    for(int j = tile->y0; j < tile->y1; j++){
+      unsigned int *sums = ctx->sums + (j + 1) * ctx->stride;
+      unsigned char *row = picture_row(pic, j);
+      for(int k = 0; k < BYTES_PER_PIXEL; k++){
+        sums[k] = 0;
+      }
+      for(int k = 0; k < pic->width * BYTES_PER_PIXEL; k++){
+        sums[k + BYTES_PER_PIXEL] = sums[k] + row[k];
+      }
+    }
+  }
+
+  // accumulate the row prefix sums down a strip of table columns
+  static void sat_columns_tile(struct picture *pic, const struct tile *tile, void *arg){
+    struct sat_ctx *ctx = (struct sat_ctx *) arg;
+    int k0 = (tile->x0 + 1) * BYTES_PER_PIXEL;
+    int k1 = (tile->x1 + 1) * BYTES_PER_PIXEL;
+    for(int j = 2; j <= pic->height; j++){
+      unsigned int *sums = ctx->sums + j * ctx->stride;
+      unsigned int *above = sums - ctx->stride;
+      for(int k = k0; k < k1; k++){
+        sums[k] += above[k];
+      }
+    }
+  }
+
+  // average the window around each pixel of a tile that is at least radius
+  // pixels from every edge, using four table lookups per byte
+  static void sat_blur_tile(struct picture *pic, const struct tile *tile, void *arg){
+    struct sat_ctx *ctx = (struct sat_ctx *) arg;
+    int r = ctx->radius;
+    unsigned int area = (2 * r + 1) * (2 * r + 1);
+
+    int x0 = tile->x0 > r ? tile->x0 : r;
+    int y0 = tile->y0 > r ? tile->y0 : r;
+    int x1 = tile->x1 < pic->width - r ? tile->x1 : pic->width - r;
+    int y1 = tile->y1 < pic->height - r ? tile->y1 : pic->height - r;
+
+    for(int j = y0; j < y1; j++){
+      unsigned int *top = ctx->sums + (j - r) * ctx->stride;
+      unsigned int *bottom = ctx->sums + (j + r + 1) * ctx->stride;
+      unsigned char *out = picture_row(pic, j);
+      for(int k = x0 * BYTES_PER_PIXEL; k < x1 * BYTES_PER_PIXEL; k++){
+        int left = k - r * BYTES_PER_PIXEL;
+        int right = k + (r + 1) * BYTES_PER_PIXEL;
+        // unsigned wrap-around cancels out, so only the window sum must fit
+        unsigned int sum = bottom[right] - bottom[left] - top[right] + top[left];
+        out[k] = sum / area;
       }
     }
+  }
+
+  void radius_blur_picture(struct picture *pic, int radius){
+    // check the radius before doing any work
+    if(!valid_blur_radius(radius)){
+      printf("[!] blur is undefined for radius %i (must be 1 to %i)\n", radius, MAX_BLUR_RADIUS);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    parallel_materialise_picture(pic);
+    make_writable(pic);
+
+    // summed-area table with a zero first row and column
+    struct sat_ctx ctx;
+    ctx.radius = radius;
+    ctx.stride = (size_t) (pic->width + 1) * BYTES_PER_PIXEL;
+    ctx.sums = malloc(ctx.stride * (pic->height + 1) * sizeof(unsigned int));
+    if(ctx.sums == NULL){
+      printf("[!] not enough memory to blur picture\n");
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    memset(ctx.sums, 0, ctx.stride * sizeof(unsigned int));
 
-    // Calculate average rgb values
-    pixel.red = total_red / BLUR_REGION_SIZE;
-    pixel.green = total_green / BLUR_REGION_SIZE;
-    pixel.blue = total_blue / BLUR_REGION_SIZE;
+    // build the table in parallel, then blur in place from it
+    parallel_for_tiles(pic, pic->width, TILE_SIZE, sat_rows_tile, &ctx);
+    parallel_for_tiles(pic, TILE_SIZE, pic->height, sat_columns_tile, &ctx);
+    parallel_for_tiles(pic, TILE_SIZE, TILE_SIZE, sat_blur_tile, &ctx);
 
-    // Set average rgb values to complete pixel blur
-    set_pixel(pic, i, j, &pixel);
+    free(ctx.sums);
   }
 
-  /* Blurs a pixel and then frees it. */
-  void blur_and_free_pixel(struct pic_info *info) {
-    blur_pixel(info);
-    free(info);
+  // source picture and number of 3x3 blur passes to fuse per tile
+  struct repeated_blur_ctx {
+    struct picture *src;
+    int passes;
+  };
+
+  /* Run every blur pass over one tile of the output picture. The tile is
+     loaded with a halo of one pixel per pass (clipped at the picture edge)
+     and the passes ping-pong between two tile buffers. Each pass computes a
+     region one pixel narrower on every halo side, which is exactly the part
+     the previous pass left correct, so the tile ends up identical to running
+     the whole-picture blur that many times. */
+  static void repeated_blur_tile(struct picture *tmp, const struct tile *tile, void *arg){
+    struct repeated_blur_ctx *ctx = (struct repeated_blur_ctx *) arg;
+    struct picture *pic = ctx->src;
+    int n = ctx->passes;
+
+    // tile plus halo, in picture coordinates
+    int lx0 = tile->x0 - n > 0 ? tile->x0 - n : 0;
+    int ly0 = tile->y0 - n > 0 ? tile->y0 - n : 0;
+    int lx1 = tile->x1 + n < pic->width ? tile->x1 + n : pic->width;
+    int ly1 = tile->y1 + n < pic->height ? tile->y1 + n : pic->height;
+
+    // ping-pong buffers both start with the original pixels, so picture
+    // boundary pixels (never written) stay unmodified in either
+    struct picture bufs[2];
+    if(!init_picture_from_size(&bufs[0], lx1 - lx0, ly1 - ly0)){
+      printf("[!] not enough memory to blur picture\n");
+      exit(IO_ERROR);
+    }
+    for(int j = ly0; j < ly1; j++){
+      memcpy(picture_row(&bufs[0], j - ly0), picture_span(pic, lx0, j), bufs[0].stride);
+    }
+    if(!copy_picture(&bufs[1], &bufs[0])){
+      printf("[!] not enough memory to blur picture\n");
+      exit(IO_ERROR);
+    }
+
+    int cur = 0;
+    for(int p = 1; p <= n; p++){
+      // region still valid after this pass, clipped to the picture interior
+      int x0 = lx0 == 0 ? 1 : lx0 + p;
+      int y0 = ly0 == 0 ? 1 : ly0 + p;
+      int x1 = lx1 == pic->width ? pic->width - 1 : lx1 - p;
+      int y1 = ly1 == pic->height ? pic->height - 1 : ly1 - p;
+
+      if(x0 < x1 && y0 < y1){
+        box_blur_region(&bufs[cur], &bufs[1 - cur], x0 - lx0, x1 - lx0, y0 - ly0, y1 - ly0);
+      }
+      cur = 1 - cur;
+    }
+
+    // copy the finished tile out of the halo buffer
+    int tile_bytes = (tile->x1 - tile->x0) * BYTES_PER_PIXEL;
+    for(int j = tile->y0; j < tile->y1; j++){
+      memcpy(picture_span(tmp, tile->x0, j),
+             picture_span(&bufs[cur], tile->x0 - lx0, j - ly0), tile_bytes);
+    }
+
+    clear_picture(&bufs[0]);
+    clear_picture(&bufs[1]);
   }
 
+  /* Every tile recomputes its halo on each pass, and the halo grows with 
+     the number of passes, so fusing too many passes costs more than it 
+     saves. Many passes are run as a sequence of fused chunks, each at most
+     MAX_FUSED_BLUR_PASSES deep, which keeps the halo to a small fraction
+     of the tile. */
+  void repeated_blur_picture(struct picture *pic, int passes){
+    // check the number of passes before doing any work
+    if(!valid_blur_passes(passes)){
+      printf("[!] blur cannot be repeated %i times\n", passes);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    parallel_materialise_picture(pic);
+
+    for(int left = passes; left > 0; left -= MAX_FUSED_BLUR_PASSES){
+      // make new temporary picture to work in
+      struct picture tmp;
+      if(!init_picture_from_size(&tmp, pic->width, pic->height)){
+        printf("[!] not enough memory to blur picture\n");
+        clear_picture(pic);
+        exit(IO_ERROR);
+      }
+
+      struct repeated_blur_ctx ctx;
+      ctx.src = pic;
+      ctx.passes = left < MAX_FUSED_BLUR_PASSES ? left : MAX_FUSED_BLUR_PASSES;
+      parallel_for_tiles(&tmp, REPEATED_BLUR_TILE_SIZE, REPEATED_BLUR_TILE_SIZE,
+                         repeated_blur_tile, &ctx);
+
+      // clean-up the old picture and replace with new picture
+      clear_picture(pic);
+      overwrite_picture(pic, &tmp);
+    }
+  }
 
   void parallel_blur_picture(struct picture *pic){
+    parallel_materialise_picture(pic);
+    make_writable(pic);
+
     // make new temporary picture to work in
     struct picture tmp;
-    tmp.img = copy_image(pic->img);
-    tmp.width = pic->width;
-    tmp.height = pic->height;
-    
-    // Initialise thread pool
-    struct t_pool pool;
-    thread_pool_init(&pool);
-
-    // Iterate over each pixel in the picture, except boundary pixels
-    for(int i = 1; i < tmp.width - 1; i++){
-      for(int j = 1; j < tmp.height - 1; j++){  
-        pthread_t thread;
-
-        // Check that a new thread thread can be created
-        while(!new_pixel_thread(&thread, pic, &tmp, i, j)) {
-          tryjoin_threads(&pool);
-        }
-        add_thread_to_pool(thread, &pool);
-      }
-    } 
+    copy_picture(&tmp, pic);
+
+    // full-width bands keep the sliding window running along whole rows
+    parallel_for_tiles(pic, pic->width, TILE_SIZE, blur_tile, &tmp);
 
-    threads_join(&pool);   
-    
     // clean-up the temporary picture
     clear_picture(&tmp);
   }
-  
-  /* Create a new thread according to specified parameters and passing in a
-     pic_info as the argument for the thread. To be used for a pixel. */
-  bool new_pixel_thread(pthread_t *thread, struct picture *pic, struct picture *tmp, int i, int j) {
-    struct pic_info *info = (struct pic_info*) malloc(sizeof(struct pic_info));
-
-    // Assign values to new pic_info
-    info->pic = pic;
-    info->tmp = tmp;
-    info->i = i;
-    info->j = j;
-
-    // Check that the new thread can be created properly and exit otherwise
-    if (pthread_create(thread, NULL, (void *(*)(void *)) blur_and_free_pixel, info) != 0) {
-      // Free resources
-      free(info);
-      return false;
-    }
-    return true;
-  }
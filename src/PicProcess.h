@@ -5,27 +5,94 @@
 #include "Utils.h"
 #include <pthread.h>
 
-struct pic_info {
-  struct picture *pic;
-  struct picture *tmp;
-  int i;
-  int j;
-  int initi;
-  int initj;
-  int endi;
-  int endj;
+// A rectangular block of pixels [x0, x1) x [y0, y1) within a picture
+struct tile {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+};
+
+// Lookup tables mapping each R, G and B value of a pixel to a new value
+struct channel_lut {
+  unsigned char table[BYTES_PER_PIXEL][256];
+  bool shared;    /* Set when all channels use the same table. */
+};
+
+// A per-pixel operation over width consecutive pixels
+struct pointwise_op {
+  void (*fn)(unsigned char *span, int width, const struct channel_lut *lut);
+  int lut;        /* Index of the operation's table in the chain, or -1. */
+};
+
+// maximum number of operations a pointwise chain can hold
+#define MAX_POINTWISE_OPS 16
+
+// Consecutive per-pixel operations that are run together in a single sweep
+struct pointwise_chain {
+  int length;
+  struct pointwise_op ops[MAX_POINTWISE_OPS];
+  struct channel_lut luts[MAX_POINTWISE_OPS];
 };
 
   // picture transformation routines
+  // NOTE: rotate and flip are lazy (see struct orientation in Picture.h)
   void invert_picture(struct picture *pic);
   void grayscale_picture(struct picture *pic);
   void rotate_picture(struct picture *pic, int angle);
   void flip_picture(struct picture *pic, char plane);
   void blur_picture(struct picture *pic);
 
-void parallel_blur_picture(struct picture *pic);
-bool new_pixel_thread(pthread_t *thread, struct picture *pic,
-                    struct picture *tmp, int i, int j);
-void blur_and_free_pixel(struct pic_info *info);
+  // check transformation arguments, so they can be rejected before any work
+  bool valid_angle(int angle);
+  bool valid_plane(char plane);
+  bool valid_blur_radius(int radius);
+  bool valid_blur_passes(int passes);
+
+  // move a picture's pixels to match its pending orientation (if any)
+  void materialise_picture(struct picture *pic);
+  void parallel_materialise_picture(struct picture *pic);
+
+  // run fn over every tile of pic in parallel on the shared thread pool
+  void parallel_for_tiles(struct picture *pic, int tile_w, int tile_h,
+          void (*fn)(struct picture *, const struct tile *, void *), void *ctx);
+
+  // parallel picture transformation routines
+  void parallel_invert_picture(struct picture *pic);
+  void parallel_grayscale_picture(struct picture *pic);
+  void parallel_rotate_picture(struct picture *pic, int angle);
+  void parallel_flip_picture(struct picture *pic, char plane);
+  void parallel_blur_picture(struct picture *pic);
+
+  // build up a chain of pointwise operations (false if the chain is full)
+  void init_pointwise_chain(struct pointwise_chain *chain);
+  bool chain_invert(struct pointwise_chain *chain);
+  bool chain_grayscale(struct pointwise_chain *chain);
+  bool chain_lut(struct pointwise_chain *chain, const struct channel_lut *lut);
+
+  // build lookup tables for per-channel transformations
+  // (the bool builders return false if an argument is out of range)
+  void invert_lut(struct channel_lut *lut);
+  bool brightness_lut(struct channel_lut *lut, int delta);
+  bool contrast_lut(struct channel_lut *lut, int percent);
+  bool gamma_lut(struct channel_lut *lut, double gamma);
+  bool levels_lut(struct channel_lut *lut, int black, int white);
+  bool threshold_lut(struct channel_lut *lut, int level);
+
+  // make lut apply then to the values it produces, as a single table
+  void compose_lut(struct channel_lut *lut, const struct channel_lut *then);
+
+  // apply every operation in the chain in order, in one parallel pass
+  void run_pointwise_chain(struct picture *pic, const struct pointwise_chain *chain);
+
+  // most 3x3 blur passes that are fused into a single sweep over the picture
+  #define MAX_FUSED_BLUR_PASSES 8
+
+  // apply the 3x3 blur passes times, in fused sweeps of up to 
+  // MAX_FUSED_BLUR_PASSES passes each
+  void repeated_blur_picture(struct picture *pic, int passes);
+
+  // blur each pixel to the mean of the (2*radius+1)^2 square around it
+  void radius_blur_picture(struct picture *pic, int radius);
 #endif
 
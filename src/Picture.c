@@ -1,35 +1,137 @@
 #include "Picture.h"
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+  static bool decode_picture_file(struct picture *pic, const char *path);
+  static bool cached_picture(struct picture *pic, const char *path, const struct stat *info);
+  static void cache_picture(struct picture *pic, const char *path, const struct stat *info);
+
+  // allocate a zeroed, unshared pixel buffer for a picture of the specified size
+  static bool alloc_pixels(struct picture *pic, int width, int height){
+    pic->width = width;
+    pic->height = height;
+    pic->stride = width * BYTES_PER_PIXEL;
+    pic->orientation = (struct orientation) {false, false, false};
+    pic->buffer = calloc(1, sizeof(struct pixel_buffer) + (size_t) pic->stride * height);
+    if(pic->buffer == NULL){
+      pic->pixels = NULL;
+      return false;
+    }
+    atomic_init(&pic->buffer->refs, 1);
+    pic->pixels = pic->buffer->data;
+    return true;
+  }
 
   bool init_picture_from_file(struct picture *pic, const char *path){
-    pic->img = load_image(path);
+    return decode_picture_file(pic, path);
+  }
+
+  bool init_cached_picture_from_file(struct picture *pic, const char *path){
+    // an unchanged file that is still cached shares its decoded pixels
+    struct stat info;
+    bool found = stat(path, &info) == 0;
+    if(found && cached_picture(pic, path, &info)){
+      return true;
+    }
+    if( !decode_picture_file(pic, path) ){
+      return false;
+    }
+    if(found){
+      cache_picture(pic, path, &info);
+    }
+    return true;
+  }
+
+  static bool decode_picture_file(struct picture *pic, const char *path){
+    sod_img img = load_image(path);
     // check for picture initialisation error
-    if( pic->img.data == 0 ){
+    if( img.data == 0 ){
+      pic->buffer = NULL;
+      pic->pixels = NULL;
       return false;
     }    
-    pic->width = get_image_width(pic->img);
-    pic->height = get_image_height(pic->img);
+    if( !alloc_pixels(pic, get_image_width(img), get_image_height(img)) ){
+      free_image(img);
+      return false;
+    }
+    // convert the decoded image once, then drop SOD's float planes
+    export_image_pixels(img, pic->pixels, pic->stride);
+    free_image(img);
     return true;
   }
 
   bool init_picture_from_size(struct picture *pic, int width, int height){
-    pic->img = create_image(width, height);
-    // check for picture initialisation error
-    if ( pic->img.data == 0 ){
+    return alloc_pixels(pic, width, height);
+  }
+
+  bool copy_picture(struct picture *pic, struct picture *src){
+    if( !alloc_pixels(pic, src->width, src->height) ){
       return false;
     }
-    pic->width = width;
-    pic->height = height;
+    for(int y = 0; y < src->height; y++){
+      memcpy(picture_row(pic, y), picture_row(src, y), pic->stride);
+    }
+    pic->orientation = src->orientation;
+    return true;
+  }
+  
+  void share_picture(struct picture *pic, struct picture *src){
+    *pic = *src;
+    atomic_fetch_add(&pic->buffer->refs, 1);
+  }
+
+  /* Only a holder of a reference can share it, so a count of one means no
+     other picture can be reading these pixels or about to. */
+  bool unshare_picture(struct picture *pic){
+    if(atomic_load(&pic->buffer->refs) == 1){
+      return true;
+    }
+    struct picture own;
+    if( !copy_picture(&own, pic) ){
+      return false;
+    }
+    clear_picture(pic);
+    overwrite_picture(pic, &own);
     return true;
   }
   
   void overwrite_picture(struct picture *pic1, struct picture *pic2){
-    pic1->img = pic2->img;
+    pic1->pixels = pic2->pixels;
+    pic1->buffer = pic2->buffer;
+    pic1->stride = pic2->stride;
     pic1->width = pic2->width;
     pic1->height = pic2->height;
+    pic1->orientation = pic2->orientation;
+  }
+
+  /* The stored pixel for (x,y) is reached by applying turn's transpose and
+     flips, then the existing orientation's. Moving the existing transpose 
+     ahead of turn's flips swaps which axis they mirror, so the result is a 
+     single transpose followed by combined flips. */
+  void orient_picture(struct picture *pic, struct orientation turn){
+    struct orientation *o = &pic->orientation;
+    bool flip_x = turn.flip_x;
+    bool flip_y = turn.flip_y;
+    if(o->transpose){
+      flip_x = turn.flip_y;
+      flip_y = turn.flip_x;
+    }
+    o->transpose ^= turn.transpose;
+    o->flip_x ^= flip_x;
+    o->flip_y ^= flip_y;
+  }
+
+  bool is_oriented(struct picture *pic){
+    struct orientation *o = &pic->orientation;
+    return o->transpose || o->flip_x || o->flip_y;
   }
 
   bool save_picture_to_file(struct picture *pic, const char *path){
-    return save_image(pic->img, path);   
+    if(is_oriented(pic)){
+      return false;
+    }
+    return save_pixels(pic->pixels, pic->width, pic->height, pic->stride, path);   
   }
 
   // enum mapping to support get/set pixel functions
@@ -38,19 +140,30 @@
   struct pixel get_pixel(struct picture *pic, int x, int y){
     // Beware: pixels are stored in a (x,y) vector from the top left of the image.
     struct pixel pix;
+    unsigned char *p = picture_span(pic, x, y);
     
-    pix.red = get_pixel_value(pic->img, RED, x, y);
-    pix.green = get_pixel_value(pic->img, GREEN, x, y);
-    pix.blue = get_pixel_value(pic->img, BLUE, x, y);
+    pix.red = p[RED];
+    pix.green = p[GREEN];
+    pix.blue = p[BLUE];
     
     return pix;
   }
 
   void set_pixel(struct picture *pic, int x, int y, struct pixel *rgb){
     // Beware: pixels are stored in a (x,y) vector from the top left of the image.
-    set_pixel_value(pic->img, RED, x, y, rgb->red);
-    set_pixel_value(pic->img, GREEN, x, y, rgb->green);
-    set_pixel_value(pic->img, BLUE, x, y, rgb->blue);
+    unsigned char *p = picture_span(pic, x, y);
+
+    p[RED] = rgb->red;
+    p[GREEN] = rgb->green;
+    p[BLUE] = rgb->blue;
+  }
+
+  unsigned char *picture_row(struct picture *pic, int y){
+    return pic->pixels + (size_t) y * pic->stride;
+  }
+
+  unsigned char *picture_span(struct picture *pic, int x, int y){
+    return picture_row(pic, y) + x * BYTES_PER_PIXEL;
   }
 
   bool contains_point(struct picture *pic, int x, int y){
@@ -58,5 +171,152 @@
   }
   
   void clear_picture(struct picture *pic){
-    free_image(pic->img); 
+    if(pic->buffer != NULL && atomic_fetch_sub(&pic->buffer->refs, 1) == 1){
+      free(pic->buffer);
+    }
+    pic->buffer = NULL;
+    pic->pixels = NULL;
   }  
+
+// ------------------------- decoded picture cache ------------------------- \\
+
+  // A decoded file, identified by its path and the file's identity, size 
+  // and modification time when it was decoded
+  struct cache_entry {
+    char *path;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    struct picture pic;             /* Holds one reference to the pixels. */
+    struct cache_entry *newer;
+    struct cache_entry *older;
+  };
+
+  // entries from most (newest) to least (oldest) recently used
+  static struct cache_entry *newest = NULL;
+  static struct cache_entry *oldest = NULL;
+  static size_t cache_used = 0;
+  static size_t cache_budget = 0;
+  static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  static size_t picture_bytes(struct picture *pic){
+    return (size_t) pic->stride * pic->height;
+  }
+
+  static void unlink_entry(struct cache_entry *entry){
+    if(entry->newer != NULL){
+      entry->newer->older = entry->older;
+    } else {
+      newest = entry->older;
+    }
+    if(entry->older != NULL){
+      entry->older->newer = entry->newer;
+    } else {
+      oldest = entry->newer;
+    }
+  }
+
+  static void push_newest(struct cache_entry *entry){
+    entry->newer = NULL;
+    entry->older = newest;
+    if(newest != NULL){
+      newest->newer = entry;
+    } else {
+      oldest = entry;
+    }
+    newest = entry;
+  }
+
+  // remove an entry (pictures already sharing its pixels keep them)
+  static void drop_entry(struct cache_entry *entry){
+    unlink_entry(entry);
+    cache_used -= picture_bytes(&entry->pic);
+    clear_picture(&entry->pic);
+    free(entry->path);
+    free(entry);
+  }
+
+  // evict least recently used entries until the cache fits in the budget
+  static void trim_cache(void){
+    while(oldest != NULL && cache_used > cache_budget){
+      drop_entry(oldest);
+    }
+  }
+
+  static bool same_file(struct cache_entry *entry, const struct stat *info){
+    return entry->device == info->st_dev && entry->inode == info->st_ino
+        && entry->size == info->st_size
+        && entry->modified.tv_sec == info->st_mtim.tv_sec
+        && entry->modified.tv_nsec == info->st_mtim.tv_nsec;
+  }
+
+  /* Look the path up (a linear scan: the budget keeps the cache to a few 
+     pictures). A hit shares the pixels and becomes most recently used; an
+     entry for a path whose file has changed since is dropped. */
+  static bool cached_picture(struct picture *pic, const char *path, const struct stat *info){
+    bool hit = false;
+    pthread_mutex_lock(&cache_lock);
+    for(struct cache_entry *entry = newest; entry != NULL; entry = entry->older){
+      if(strcmp(entry->path, path)){
+        continue;
+      }
+      if(same_file(entry, info)){
+        share_picture(pic, &entry->pic);
+        unlink_entry(entry);
+        push_newest(entry);
+        hit = true;
+      } else {
+        drop_entry(entry);
+      }
+      break;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return hit;
+  }
+
+  // keep a shared reference to a freshly decoded picture, if it fits
+  static void cache_picture(struct picture *pic, const char *path, const struct stat *info){
+    pthread_mutex_lock(&cache_lock);
+    if(picture_bytes(pic) > cache_budget){
+      pthread_mutex_unlock(&cache_lock);
+      return;
+    }
+    // another thread may have decoded the same file in the meantime
+    for(struct cache_entry *entry = newest; entry != NULL; entry = entry->older){
+      if(!strcmp(entry->path, path)){
+        pthread_mutex_unlock(&cache_lock);
+        return;
+      }
+    }
+
+    struct cache_entry *entry = malloc(sizeof(struct cache_entry));
+    char *copy = strdup(path);
+    if(entry == NULL || copy == NULL){
+      free(entry);
+      free(copy);
+      pthread_mutex_unlock(&cache_lock);
+      return;
+    }
+    entry->path = copy;
+    entry->device = info->st_dev;
+    entry->inode = info->st_ino;
+    entry->size = info->st_size;
+    entry->modified = info->st_mtim;
+    share_picture(&entry->pic, pic);
+    push_newest(entry);
+    cache_used += picture_bytes(pic);
+    trim_cache();
+    pthread_mutex_unlock(&cache_lock);
+  }
+
+  void set_picture_cache_budget(size_t budget){
+    pthread_mutex_lock(&cache_lock);
+    cache_budget = budget;
+    trim_cache();
+    pthread_mutex_unlock(&cache_lock);
+  }
+
+  void clear_picture_cache(void){
+    set_picture_cache_budget(0);
+  }
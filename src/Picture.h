@@ -3,6 +3,10 @@
 
 #include "Utils.h"
 #include <stdbool.h>
+#include <stdatomic.h>
+
+  // number of bytes used by each pixel in a picture's pixel data
+  #define BYTES_PER_PIXEL 3
 
   // The pixel struct is used to represent a pixel of an image in RGB format
   struct pixel {
@@ -11,37 +15,106 @@
     int blue;
   };
 
-  // The picture struct provides a wrapper for image manipulation 
-  // via the SOD library (https://sod.pixlab.io/intro.html)
+  /* A pending symmetry of the square (a rotation and/or mirror) that has not
+     been applied to a picture's pixels yet. Pixel (x,y) of the oriented 
+     picture is found in the stored pixels by swapping x and y if transpose
+     is set, then mirroring across the stored width (flip_x) and/or height
+     (flip_y). All false means the stored pixels are the picture. */
+  struct orientation {
+    bool transpose;
+    bool flip_x;
+    bool flip_y;
+  };
+
+  // Reference-counted storage for pixel data that pictures can share
+  struct pixel_buffer {
+    atomic_int refs;
+    unsigned char data[];
+  };
+
+  // The picture struct holds an image as packed 8-bit RGB pixels. The SOD
+  // library (https://sod.pixlab.io/intro.html) is only used to decode and 
+  // encode image files.
   struct picture {    
-    // sod representation of an image
-    sod_img img;
+    // pixel data, row by row from the top left, 3 bytes (R,G,B) per pixel
+    // NOTE: may be shared with other pictures (see unshare_picture)
+    unsigned char *pixels;
+    // the buffer holding pixels, and one of its references
+    struct pixel_buffer *buffer;
+    // number of bytes from the start of one row to the start of the next
+    int stride;
     int width;
     int height;
+    // rotation/flip still to be applied to the stored pixels (see above)
+    // NOTE: width, height and stride always describe the stored pixels
+    struct orientation orientation;
   };    
       
   // initialise picture struct with image from a provided file
   bool init_picture_from_file(struct picture *pic, const char *path);
 
+  // as init_picture_from_file, but through the picture cache (see below)
+  // NOTE: the pixels may be shared with the cache, and are copied on write
+  bool init_cached_picture_from_file(struct picture *pic, const char *path);
+
   // initialise picture struct of the specified size 
   bool init_picture_from_size(struct picture *pic, int width, int height); 
   
+  // initialise picture struct with a copy of the image stored in src
+  bool copy_picture(struct picture *pic, struct picture *src);
+
+  // initialise picture struct to share the pixels of src, in O(1); the 
+  // pixels are only copied once either picture is made writable
+  void share_picture(struct picture *pic, struct picture *src);
+
+  // give the picture pixels of its own (copying them only if they are 
+  // shared), so that they can be written; false if out of memory
+  bool unshare_picture(struct picture *pic);
+  
   // overwrites the stored image in pic1 with the stored image in pic2
+  // NOTE: pic1 takes over pic2's reference to the pixels
   void overwrite_picture(struct picture *pic1, struct picture *pic2);
 
+  // compose turn onto the picture's pending orientation without touching pixels
+  void orient_picture(struct picture *pic, struct orientation turn);
+
+  // check if the picture has an orientation that is yet to be applied
+  bool is_oriented(struct picture *pic);
+
   // save picture to specified file
+  // NOTE: fails on a picture with a pending orientation, which must be
+  //       materialised first (see PicProcess.h)
   bool save_picture_to_file(struct picture *pic, const char *path);
 
   // extract a single pixel from the image as a colour struct
+  // NOTE: (x,y) must lie within the picture (see contains_point)
   struct pixel get_pixel(struct picture *pic, int x, int y);
 
   // set a single pixel in the image from a colour struct
+  // NOTE: like any write through picture_row/span, the pixels must be unshared
   void set_pixel(struct picture *pic, int x, int y, struct pixel *rgb);
 
+  // direct access to the R,G,B bytes of row y, running left to right
+  // NOTE: consecutive rows are pic->stride bytes apart
+  unsigned char *picture_row(struct picture *pic, int y);
+
+  // direct access to the R,G,B bytes of the pixel at (x,y) and those to its right
+  unsigned char *picture_span(struct picture *pic, int x, int y);
+
   // check if coordinates are within bounds of the stored image
   bool contains_point(struct picture *pic, int x, int y);
   
-  // clean up the underlying image representation
+  /* Keep up to budget bytes of decoded pictures (least recently used are 
+     evicted first), so that loading a file again through 
+     init_cached_picture_from_file shares its pixels instead of decoding it.
+     Files are matched by path, device, inode, size and modification time.
+     The budget is 0, caching nothing, until set. */
+  void set_picture_cache_budget(size_t budget);
+
+  // drop every cached picture (pictures sharing their pixels keep them)
+  void clear_picture_cache(void);
+
+  // release the picture's reference to its pixels (freed with the last one)
   void clear_picture(struct picture *pic);
 
 #endif
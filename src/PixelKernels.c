@@ -0,0 +1,405 @@
+#include "PixelKernels.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define X86_KERNELS
+#include <immintrin.h>
+#endif
+
+  #define BYTES_PER_PIXEL 3
+  #define NO_RGB_COMPONENTS 3
+  #define MAX_INTENSITY 255
+  // (sum * DIV3_MULTIPLIER) >> 16 == sum / 3 for every sum of three bytes
+  #define DIV3_MULTIPLIER 21846
+
+  // instruction sets in increasing order of preference
+  enum kernel_level {SCALAR, SSE2, SSSE3, AVX2};
+  static const char *level_names[] = {"scalar", "sse2", "ssse3", "avx2"};
+
+  static void invert_scalar(unsigned char *span, int width);
+  static void grayscale_scalar(unsigned char *span, int width);
+  static void reverse_swap_scalar(unsigned char *a, unsigned char *b, int width);
+  static void lut_scalar(unsigned char *bytes, int n, const unsigned char *table);
+
+  // selected kernels (plain C until start-up selection has run)
+  static enum kernel_level level = SCALAR;
+  static void (*invert_impl)(unsigned char *, int) = invert_scalar;
+  static void (*grayscale_impl)(unsigned char *, int) = grayscale_scalar;
+  static void (*reverse_swap_impl)(unsigned char *, unsigned char *, int) = reverse_swap_scalar;
+  static void (*lut_impl)(unsigned char *, int, const unsigned char *) = lut_scalar;
+
+  void invert_pixels(unsigned char *span, int width){
+    invert_impl(span, width);
+  }
+
+  void grayscale_pixels(unsigned char *span, int width){
+    grayscale_impl(span, width);
+  }
+
+  void reverse_swap_pixels(unsigned char *a, unsigned char *b, int width){
+    reverse_swap_impl(a, b, width);
+  }
+
+  /* Byte lookups with a different table per channel do not vectorise: a 
+     shuffle can only index one table per lane. Plain loads are as fast as
+     anything else here, so there is a single version. */
+  void lut_pixels(unsigned char *span, int width, const unsigned char tables[][256]){
+    for(int i = 0; i < width; i++){
+      unsigned char *p = span + i * BYTES_PER_PIXEL;
+      p[0] = tables[0][p[0]];
+      p[1] = tables[1][p[1]];
+      p[2] = tables[2][p[2]];
+    }
+  }
+
+  void lut_bytes(unsigned char *bytes, int n, const unsigned char *table){
+    lut_impl(bytes, n, table);
+  }
+
+// ---------------------------- scalar kernels ---------------------------- \\
+
+  // invert n bytes (vector kernels finish with this on any byte boundary)
+  static void invert_bytes(unsigned char *bytes, int n){
+    for(int k = 0; k < n; k++){
+      bytes[k] = MAX_INTENSITY - bytes[k];
+    }
+  }
+
+  static void invert_scalar(unsigned char *span, int width){
+    invert_bytes(span, width * BYTES_PER_PIXEL);
+  }
+
+  static void grayscale_scalar(unsigned char *span, int width){
+    for(int i = 0; i < width; i++){
+      unsigned char *p = span + i * BYTES_PER_PIXEL;
+      int avg = (p[0] + p[1] + p[2]) / NO_RGB_COMPONENTS;
+      p[0] = avg;
+      p[1] = avg;
+      p[2] = avg;
+    }
+  }
+
+  // swap pixels [from, to) of a with their mirror pixels in b
+  static void reverse_swap_range(unsigned char *a, unsigned char *b, int width,
+                                 int from, int to){
+    for(int i = from; i < to; i++){
+      unsigned char *p = a + i * BYTES_PER_PIXEL;
+      unsigned char *q = b + (width - 1 - i) * BYTES_PER_PIXEL;
+      for(int c = 0; c < BYTES_PER_PIXEL; c++){
+        unsigned char tmp = p[c];
+        p[c] = q[c];
+        q[c] = tmp;
+      }
+    }
+  }
+
+  static void reverse_swap_scalar(unsigned char *a, unsigned char *b, int width){
+    reverse_swap_range(a, b, width, 0, a == b ? width / 2 : width);
+  }
+
+  static void lut_scalar(unsigned char *bytes, int n, const unsigned char *table){
+    for(int k = 0; k < n; k++){
+      bytes[k] = table[bytes[k]];
+    }
+  }
+
+#ifdef X86_KERNELS
+
+// ------------------------------ SSE kernels ----------------------------- \\
+
+  // pshufb masks moving channel c of 16 pixels out of each of the three
+  // vectors holding them, and spreading 16 gray values back over 48 bytes
+  static unsigned char gather_masks[NO_RGB_COMPONENTS][3][16];
+  static unsigned char spread_masks[3][16];
+  // pshufb masks building each of three output vectors of 16 reversed pixels
+  // from each of the three input vectors
+  static unsigned char reverse_masks[3][3][16];
+
+  static void build_shuffle_masks(void){
+    for(int c = 0; c < NO_RGB_COMPONENTS; c++){
+      for(int v = 0; v < 3; v++){
+        for(int i = 0; i < 16; i++){
+          int byte = i * BYTES_PER_PIXEL + c;
+          // 0x80 zeroes a lane that this vector does not hold
+          gather_masks[c][v][i] = byte / 16 == v ? byte % 16 : 0x80;
+        }
+      }
+    }
+    for(int v = 0; v < 3; v++){
+      for(int i = 0; i < 16; i++){
+        spread_masks[v][i] = (v * 16 + i) / BYTES_PER_PIXEL;
+      }
+    }
+    for(int o = 0; o < 3; o++){
+      for(int i = 0; i < 16; i++){
+        int pixel = (o * 16 + i) / BYTES_PER_PIXEL;
+        int byte = (15 - pixel) * BYTES_PER_PIXEL + (o * 16 + i) % BYTES_PER_PIXEL;
+        for(int v = 0; v < 3; v++){
+          reverse_masks[o][v][i] = byte / 16 == v ? byte % 16 : 0x80;
+        }
+      }
+    }
+  }
+
+  // inverting a byte is the same as 255 - byte
+  __attribute__((target("sse2")))
+  static void invert_sse2(unsigned char *span, int width){
+    int n = width * BYTES_PER_PIXEL;
+    int k = 0;
+    __m128i ones = _mm_set1_epi8(-1);
+    for(; k + 16 <= n; k += 16){
+      __m128i v = _mm_loadu_si128((__m128i *) (span + k));
+      _mm_storeu_si128((__m128i *) (span + k), _mm_xor_si128(v, ones));
+    }
+    invert_bytes(span + k, n - k);
+  }
+
+  __attribute__((target("ssse3")))
+  static __m128i gather_channel_ssse3(__m128i v0, __m128i v1, __m128i v2, int c){
+    __m128i r = _mm_shuffle_epi8(v0, _mm_loadu_si128((__m128i *) gather_masks[c][0]));
+    r = _mm_or_si128(r, _mm_shuffle_epi8(v1, _mm_loadu_si128((__m128i *) gather_masks[c][1])));
+    return _mm_or_si128(r, _mm_shuffle_epi8(v2, _mm_loadu_si128((__m128i *) gather_masks[c][2])));
+  }
+
+  // 16 pixels per step: de-interleave, average in 16-bit lanes, re-interleave
+  __attribute__((target("ssse3")))
+  static void grayscale_ssse3(unsigned char *span, int width){
+    int i = 0;
+    __m128i zero = _mm_setzero_si128();
+    __m128i div3 = _mm_set1_epi16(DIV3_MULTIPLIER);
+    for(; i + 16 <= width; i += 16){
+      __m128i *p = (__m128i *) (span + i * BYTES_PER_PIXEL);
+      __m128i v0 = _mm_loadu_si128(p);
+      __m128i v1 = _mm_loadu_si128(p + 1);
+      __m128i v2 = _mm_loadu_si128(p + 2);
+
+      __m128i r = gather_channel_ssse3(v0, v1, v2, 0);
+      __m128i g = gather_channel_ssse3(v0, v1, v2, 1);
+      __m128i b = gather_channel_ssse3(v0, v1, v2, 2);
+
+      __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(r, zero),
+                   _mm_unpacklo_epi8(g, zero)), _mm_unpacklo_epi8(b, zero));
+      __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(r, zero),
+                   _mm_unpackhi_epi8(g, zero)), _mm_unpackhi_epi8(b, zero));
+      __m128i avg = _mm_packus_epi16(_mm_mulhi_epu16(lo, div3), _mm_mulhi_epu16(hi, div3));
+
+      _mm_storeu_si128(p, _mm_shuffle_epi8(avg, _mm_loadu_si128((__m128i *) spread_masks[0])));
+      _mm_storeu_si128(p + 1, _mm_shuffle_epi8(avg, _mm_loadu_si128((__m128i *) spread_masks[1])));
+      _mm_storeu_si128(p + 2, _mm_shuffle_epi8(avg, _mm_loadu_si128((__m128i *) spread_masks[2])));
+    }
+    grayscale_scalar(span + i * BYTES_PER_PIXEL, width - i);
+  }
+
+  // reverse the order of the 16 pixels held in v[0..2], in registers
+  __attribute__((target("ssse3")))
+  static void reverse_16_ssse3(__m128i *v){
+    __m128i out[3];
+    for(int o = 0; o < 3; o++){
+      out[o] = _mm_shuffle_epi8(v[0], _mm_loadu_si128((__m128i *) reverse_masks[o][0]));
+      out[o] = _mm_or_si128(out[o], _mm_shuffle_epi8(v[1], _mm_loadu_si128((__m128i *) reverse_masks[o][1])));
+      out[o] = _mm_or_si128(out[o], _mm_shuffle_epi8(v[2], _mm_loadu_si128((__m128i *) reverse_masks[o][2])));
+    }
+    v[0] = out[0];
+    v[1] = out[1];
+    v[2] = out[2];
+  }
+
+  // swap 16-pixel blocks from the left of a with blocks from the right of b,
+  // reversing each in registers, then finish the middle in plain C
+  __attribute__((target("ssse3")))
+  static void reverse_swap_ssse3(unsigned char *a, unsigned char *b, int width){
+    int limit = a == b ? width / 2 : width;
+    int i = 0;
+    for(; i + 16 <= limit; i += 16){
+      __m128i *p = (__m128i *) (a + i * BYTES_PER_PIXEL);
+      __m128i *q = (__m128i *) (b + (width - 16 - i) * BYTES_PER_PIXEL);
+      __m128i left[3], right[3];
+      for(int v = 0; v < 3; v++){
+        left[v] = _mm_loadu_si128(p + v);
+        right[v] = _mm_loadu_si128(q + v);
+      }
+      reverse_16_ssse3(left);
+      reverse_16_ssse3(right);
+      for(int v = 0; v < 3; v++){
+        _mm_storeu_si128(p + v, right[v]);
+        _mm_storeu_si128(q + v, left[v]);
+      }
+    }
+    reverse_swap_range(a, b, width, i, limit);
+  }
+
+  /* A 256-entry table is looked up as 16 windows of 16 entries, one pshufb
+     each. Before window w the bytes have had 16*w subtracted; adding 0x70
+     with unsigned saturation leaves bytes that fall inside the window as 
+     0x70 + offset and pushes every other byte to 0x80 or above, which
+     pshufb turns into zero, so OR-ing the 16 shuffles gives the lookup. */
+  #define LUT_WINDOWS 16
+
+  __attribute__((target("ssse3")))
+  static void lut_ssse3(unsigned char *bytes, int n, const unsigned char *table){
+    __m128i windows[LUT_WINDOWS];
+    for(int w = 0; w < LUT_WINDOWS; w++){
+      windows[w] = _mm_loadu_si128((__m128i *) (table + 16 * w));
+    }
+    __m128i bias = _mm_set1_epi8(0x70);
+    __m128i step = _mm_set1_epi8(16);
+
+    int k = 0;
+    for(; k + 16 <= n; k += 16){
+      __m128i v = _mm_loadu_si128((__m128i *) (bytes + k));
+      __m128i r = _mm_setzero_si128();
+      for(int w = 0; w < LUT_WINDOWS; w++){
+        r = _mm_or_si128(r, _mm_shuffle_epi8(windows[w], _mm_adds_epu8(v, bias)));
+        v = _mm_sub_epi8(v, step);
+      }
+      _mm_storeu_si128((__m128i *) (bytes + k), r);
+    }
+    lut_scalar(bytes + k, n - k, table);
+  }
+
+// ----------------------------- AVX2 kernels ----------------------------- \\
+
+  __attribute__((target("avx2")))
+  static void invert_avx2(unsigned char *span, int width){
+    int n = width * BYTES_PER_PIXEL;
+    int k = 0;
+    __m256i ones = _mm256_set1_epi8(-1);
+    for(; k + 32 <= n; k += 32){
+      __m256i v = _mm256_loadu_si256((__m256i *) (span + k));
+      _mm256_storeu_si256((__m256i *) (span + k), _mm256_xor_si256(v, ones));
+    }
+    invert_bytes(span + k, n - k);
+  }
+
+  // load bytes [0,16) of a and b into the low and high lanes of one vector
+  __attribute__((target("avx2")))
+  static __m256i load_lanes(unsigned char *a, unsigned char *b){
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(
+             _mm_loadu_si128((__m128i *) a)), _mm_loadu_si128((__m128i *) b), 1);
+  }
+
+  __attribute__((target("avx2")))
+  static void store_lanes(unsigned char *a, unsigned char *b, __m256i v){
+    _mm_storeu_si128((__m128i *) a, _mm256_castsi256_si128(v));
+    _mm_storeu_si128((__m128i *) b, _mm256_extracti128_si256(v, 1));
+  }
+
+  __attribute__((target("avx2")))
+  static __m256i gather_channel_avx2(__m256i v0, __m256i v1, __m256i v2, int c){
+    __m256i r = _mm256_shuffle_epi8(v0, _mm256_broadcastsi128_si256(
+                  _mm_loadu_si128((__m128i *) gather_masks[c][0])));
+    r = _mm256_or_si256(r, _mm256_shuffle_epi8(v1, _mm256_broadcastsi128_si256(
+                  _mm_loadu_si128((__m128i *) gather_masks[c][1]))));
+    return _mm256_or_si256(r, _mm256_shuffle_epi8(v2, _mm256_broadcastsi128_si256(
+                  _mm_loadu_si128((__m128i *) gather_masks[c][2]))));
+  }
+
+  __attribute__((target("avx2")))
+  static __m256i spread_gray_avx2(__m256i avg, int v){
+    return _mm256_shuffle_epi8(avg, _mm256_broadcastsi128_si256(
+             _mm_loadu_si128((__m128i *) spread_masks[v])));
+  }
+
+  /* 32 pixels per step. AVX2 byte shuffles stay within 128-bit lanes, so
+     each lane holds its own run of 16 pixels (48 bytes) and the SSSE3
+     masks apply to both lanes unchanged. */
+  __attribute__((target("avx2")))
+  static void grayscale_avx2(unsigned char *span, int width){
+    int i = 0;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i div3 = _mm256_set1_epi16(DIV3_MULTIPLIER);
+    for(; i + 32 <= width; i += 32){
+      unsigned char *a = span + i * BYTES_PER_PIXEL;
+      unsigned char *b = a + 16 * BYTES_PER_PIXEL;
+      __m256i v0 = load_lanes(a, b);
+      __m256i v1 = load_lanes(a + 16, b + 16);
+      __m256i v2 = load_lanes(a + 32, b + 32);
+
+      __m256i r = gather_channel_avx2(v0, v1, v2, 0);
+      __m256i g = gather_channel_avx2(v0, v1, v2, 1);
+      __m256i bl = gather_channel_avx2(v0, v1, v2, 2);
+
+      __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(r, zero),
+                   _mm256_unpacklo_epi8(g, zero)), _mm256_unpacklo_epi8(bl, zero));
+      __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(r, zero),
+                   _mm256_unpackhi_epi8(g, zero)), _mm256_unpackhi_epi8(bl, zero));
+      __m256i avg = _mm256_packus_epi16(_mm256_mulhi_epu16(lo, div3),
+                                        _mm256_mulhi_epu16(hi, div3));
+
+      store_lanes(a, b, spread_gray_avx2(avg, 0));
+      store_lanes(a + 16, b + 16, spread_gray_avx2(avg, 1));
+      store_lanes(a + 32, b + 32, spread_gray_avx2(avg, 2));
+    }
+    grayscale_ssse3(span + i * BYTES_PER_PIXEL, width - i);
+  }
+
+  // the SSSE3 table lookup with each window copied into both lanes
+  __attribute__((target("avx2")))
+  static void lut_avx2(unsigned char *bytes, int n, const unsigned char *table){
+    __m256i windows[LUT_WINDOWS];
+    for(int w = 0; w < LUT_WINDOWS; w++){
+      windows[w] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) (table + 16 * w)));
+    }
+    __m256i bias = _mm256_set1_epi8(0x70);
+    __m256i step = _mm256_set1_epi8(16);
+
+    int k = 0;
+    for(; k + 32 <= n; k += 32){
+      __m256i v = _mm256_loadu_si256((__m256i *) (bytes + k));
+      __m256i r = _mm256_setzero_si256();
+      for(int w = 0; w < LUT_WINDOWS; w++){
+        r = _mm256_or_si256(r, _mm256_shuffle_epi8(windows[w], _mm256_adds_epu8(v, bias)));
+        v = _mm256_sub_epi8(v, step);
+      }
+      _mm256_storeu_si256((__m256i *) (bytes + k), r);
+    }
+    lut_ssse3(bytes + k, n - k, table);
+  }
+
+#endif
+
+// --------------------------- kernel selection --------------------------- \\
+
+  // pick the best kernels for this CPU before main runs
+  __attribute__((constructor))
+  static void select_pixel_kernels(void){
+    enum kernel_level best = SCALAR;
+
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+      best = AVX2;
+    } else if(__builtin_cpu_supports("ssse3")){
+      best = SSSE3;
+    } else if(__builtin_cpu_supports("sse2")){
+      best = SSE2;
+    }
+    build_shuffle_masks();
+#endif
+
+    // allow the choice to be capped (e.g. to compare against plain C)
+    const char *cap = getenv("PICTURE_KERNELS");
+    for(int l = SCALAR; cap != NULL && l < best; l++){
+      if(!strcmp(cap, level_names[l])){
+        best = l;
+      }
+    }
+
+    level = best;
+#ifdef X86_KERNELS
+    if(level >= SSE2){
+      invert_impl = invert_sse2;
+    }
+    if(level >= SSSE3){
+      grayscale_impl = grayscale_ssse3;
+      reverse_swap_impl = reverse_swap_ssse3;
+      lut_impl = lut_ssse3;
+    }
+    if(level >= AVX2){
+      invert_impl = invert_avx2;
+      grayscale_impl = grayscale_avx2;
+      lut_impl = lut_avx2;
+    }
+#endif
+  }
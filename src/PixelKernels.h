@@ -0,0 +1,24 @@
+#ifndef PIXELKERNELS_H
+#define PIXELKERNELS_H
+
+  // Kernels over spans of packed 8-bit RGB pixels. The fastest variant the
+  // CPU supports (AVX2, SSSE3, SSE2 or plain C) is chosen at start-up via
+  // CPUID; setting PICTURE_KERNELS=scalar|sse2|ssse3|avx2 caps the choice.
+
+  // invert the RGB values of width consecutive pixels
+  void invert_pixels(unsigned char *span, int width);
+
+  // set width consecutive pixels to the integer average of their RGB values
+  void grayscale_pixels(unsigned char *span, int width);
+
+  // swap pixel i of row a with pixel width-1-i of row b for every i; when a
+  // and b are the same row this reverses it in place
+  void reverse_swap_pixels(unsigned char *a, unsigned char *b, int width);
+
+  // replace each byte of channel c in width consecutive pixels with tables[c][byte]
+  void lut_pixels(unsigned char *span, int width, const unsigned char tables[][256]);
+
+  // replace each of n bytes with table[byte] (one table shared by all channels)
+  void lut_bytes(unsigned char *bytes, int n, const unsigned char *table);
+
+#endif
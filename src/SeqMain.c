@@ -4,6 +4,11 @@
 #include "Utils.h"
 #include "Picture.h"
 #include "PicProcess.h"
+#include "ThreadPool.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <strings.h>
+#include <errno.h>
 
   // list of all possible picture transformations
   static char *cmd_strings[] = { 
@@ -12,7 +17,18 @@
     "rotate",
     "flip",
     "blur",
-    "parallel-blur"
+    "parallel-invert",
+    "parallel-grayscale",
+    "parallel-rotate",
+    "parallel-flip",
+    "parallel-blur",
+    "repeated-blur",
+    "pointwise",
+    "brightness",
+    "contrast",
+    "gamma",
+    "levels",
+    "threshold"
   };
 
 // -------------- picture transformation function wrappers -------------- \\
@@ -39,16 +55,227 @@
     flip_picture(pic, plane);
   }
 
-  void blur_picture_wrapper(struct picture *pic, const char *unused){
-    printf("calling blur\n");
-    blur_picture(pic);
+  void blur_picture_wrapper(struct picture *pic, const char *extra_arg){
+    // an optional radius selects the summed-area table blur
+    if(extra_arg == NULL){
+      printf("calling blur\n");
+      blur_picture(pic);
+      return;
+    }
+    int radius = atoi(extra_arg);
+    printf("calling blur (%i)\n", radius);
+    radius_blur_picture(pic, radius);
   }
   
+  void parallel_invert_wrapper(struct picture *pic, const char *unused){
+    printf("calling parallel invert\n");
+    parallel_invert_picture(pic);
+  }
+
+  void parallel_grayscale_wrapper(struct picture *pic, const char *unused){
+    printf("calling parallel grayscale\n");
+    parallel_grayscale_picture(pic);
+  }
+
+  void parallel_rotate_wrapper(struct picture *pic, const char *extra_arg){
+    int angle = atoi(extra_arg);
+    printf("calling parallel rotate (%i)\n", angle);
+    parallel_rotate_picture(pic, angle);
+  }
+
+  void parallel_flip_wrapper(struct picture *pic, const char *extra_arg){
+    char plane = extra_arg[0];
+    printf("calling parallel flip (%c)\n", plane);
+    parallel_flip_picture(pic, plane);
+  }
+
   void parallel_blur_wrapper(struct picture *pic, const char *unused){
     printf("calling parallel blur\n");
     parallel_blur_picture(pic);
   }
 
+  void repeated_blur_wrapper(struct picture *pic, const char *extra_arg){
+    if(extra_arg == NULL){
+      printf("[!] repeated-blur needs the number of passes\n");
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    int passes = atoi(extra_arg);
+    printf("calling repeated blur (%i)\n", passes);
+    repeated_blur_picture(pic, passes);
+  }
+
+  // maximum number of processes in one process list
+  #define MAX_CHAIN_LENGTH 64
+
+  // one entry of a comma-separated process list: name or name:arg
+  struct list_entry {
+    const char *name;
+    const char *arg;
+  };
+
+  /* Split a comma-separated process list in place into its entries, returning
+     how many there are. Aborts if there are more than MAX_CHAIN_LENGTH. */
+  static int split_list(char *list, struct list_entry *entries){
+    int no_entries = 0;
+    char *rest;
+    for(char *name = strtok_r(list, ",", &rest); name != NULL; name = strtok_r(NULL, ",", &rest)){
+      if(no_entries == MAX_CHAIN_LENGTH){
+        printf("[!] too many processes requested (at most %i)\n", MAX_CHAIN_LENGTH);
+        exit(IO_ERROR);
+      }
+      char *arg = strchr(name, ':');
+      if(arg != NULL){
+        *arg++ = '\0';
+      }
+      entries[no_entries].name = name;
+      entries[no_entries].arg = arg;
+      no_entries++;
+    }
+    return no_entries;
+  }
+
+  // add a lookup table to chain, if it was built from a valid argument
+  static bool chain_built_lut(struct pointwise_chain *chain, bool built,
+                              struct channel_lut *lut){
+    return built && chain_lut(chain, lut);
+  }
+
+  static bool add_invert(struct pointwise_chain *chain, const char *unused){
+    return chain_invert(chain);
+  }
+
+  static bool add_grayscale(struct pointwise_chain *chain, const char *unused){
+    return chain_grayscale(chain);
+  }
+
+  static bool add_brightness(struct pointwise_chain *chain, const char *arg){
+    struct channel_lut lut;
+    return arg != NULL && chain_built_lut(chain, brightness_lut(&lut, atoi(arg)), &lut);
+  }
+
+  static bool add_contrast(struct pointwise_chain *chain, const char *arg){
+    struct channel_lut lut;
+    return arg != NULL && chain_built_lut(chain, contrast_lut(&lut, atoi(arg)), &lut);
+  }
+
+  static bool add_gamma(struct pointwise_chain *chain, const char *arg){
+    struct channel_lut lut;
+    return arg != NULL && chain_built_lut(chain, gamma_lut(&lut, atof(arg)), &lut);
+  }
+
+  // levels take their black and white points as black:white
+  static bool add_levels(struct pointwise_chain *chain, const char *arg){
+    struct channel_lut lut;
+    const char *white = arg == NULL ? NULL : strchr(arg, ':');
+    return white != NULL
+        && chain_built_lut(chain, levels_lut(&lut, atoi(arg), atoi(white + 1)), &lut);
+  }
+
+  static bool add_threshold(struct pointwise_chain *chain, const char *arg){
+    struct channel_lut lut;
+    return arg != NULL && chain_built_lut(chain, threshold_lut(&lut, atoi(arg)), &lut);
+  }
+
+  // pointwise processes that can be fused into a single pass
+  static const struct {
+    const char *name;
+    bool (*add)(struct pointwise_chain *chain, const char *arg);
+  } pointwise_cmds[] = {
+    {"invert", add_invert},
+    {"grayscale", add_grayscale},
+    {"brightness", add_brightness},
+    {"contrast", add_contrast},
+    {"gamma", add_gamma},
+    {"levels", add_levels},
+    {"threshold", add_threshold}
+  };
+
+  static int no_of_pointwise_cmds = sizeof(pointwise_cmds) / sizeof(pointwise_cmds[0]);
+
+  // index of the named pointwise process (no_of_pointwise_cmds if there is none)
+  static int find_pointwise_cmd(const char *name){
+    int op_no = 0;
+    while(op_no < no_of_pointwise_cmds && strcmp(name, pointwise_cmds[op_no].name)){
+      op_no++;
+    }
+    return op_no;
+  }
+
+  // add the named pointwise process to chain, aborting on an invalid process
+  static void add_pointwise_cmd(struct picture *pic, struct pointwise_chain *chain,
+                                const char *name, const char *arg){
+    int op_no = find_pointwise_cmd(name);
+    if(op_no == no_of_pointwise_cmds){
+      printf("[!] %s is not a pointwise process\n", name);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    if(!pointwise_cmds[op_no].add(chain, arg)){
+      printf("[!] invalid argument for %s (or more than %i pointwise processes)\n", 
+             name, MAX_POINTWISE_OPS);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  // run a single pointwise process on its own
+  static void run_pointwise_cmd(struct picture *pic, const char *name, const char *arg){
+    struct pointwise_chain chain;
+    init_pointwise_chain(&chain);
+    add_pointwise_cmd(pic, &chain, name, arg);
+    run_pointwise_chain(pic, &chain);
+  }
+
+  void brightness_wrapper(struct picture *pic, const char *extra_arg){
+    printf("calling brightness (%s)\n", extra_arg);
+    run_pointwise_cmd(pic, "brightness", extra_arg);
+  }
+
+  void contrast_wrapper(struct picture *pic, const char *extra_arg){
+    printf("calling contrast (%s)\n", extra_arg);
+    run_pointwise_cmd(pic, "contrast", extra_arg);
+  }
+
+  void gamma_wrapper(struct picture *pic, const char *extra_arg){
+    printf("calling gamma (%s)\n", extra_arg);
+    run_pointwise_cmd(pic, "gamma", extra_arg);
+  }
+
+  void levels_wrapper(struct picture *pic, const char *extra_arg){
+    printf("calling levels (%s)\n", extra_arg);
+    run_pointwise_cmd(pic, "levels", extra_arg);
+  }
+
+  void threshold_wrapper(struct picture *pic, const char *extra_arg){
+    printf("calling threshold (%s)\n", extra_arg);
+    run_pointwise_cmd(pic, "threshold", extra_arg);
+  }
+
+  // run a comma-separated list of pointwise processes (each name or name:arg)
+  // as one fused chain
+  void pointwise_wrapper(struct picture *pic, const char *extra_arg){
+    if(extra_arg == NULL){
+      printf("[!] pointwise needs a comma-separated list of processes\n");
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    printf("calling pointwise (%s)\n", extra_arg);
+
+    // collect every process in the list into one chain
+    struct pointwise_chain chain;
+    init_pointwise_chain(&chain);
+    char list[strlen(extra_arg) + 1];
+    strcpy(list, extra_arg);
+    struct list_entry entries[MAX_CHAIN_LENGTH];
+    int no_entries = split_list(list, entries);
+    for(int i = 0; i < no_entries; i++){
+      add_pointwise_cmd(pic, &chain, entries[i].name, entries[i].arg);
+    }
+
+    run_pointwise_chain(pic, &chain);
+  }
+
 // ------------------------------------------------------------------------ \\
 
   // function pointer look-up table for picture transformation functions
@@ -58,19 +285,506 @@
     rotate_picture_wrapper,
     flip_picture_wrapper,
     blur_picture_wrapper,
-    parallel_blur_wrapper
+    parallel_invert_wrapper,
+    parallel_grayscale_wrapper,
+    parallel_rotate_wrapper,
+    parallel_flip_wrapper,
+    parallel_blur_wrapper,
+    repeated_blur_wrapper,
+    pointwise_wrapper,
+    brightness_wrapper,
+    contrast_wrapper,
+    gamma_wrapper,
+    levels_wrapper,
+    threshold_wrapper
   };
 
   // size of look-up table (for safe IO error reporting)
   static int no_of_cmds = sizeof(cmds) / sizeof(cmds[0]);
 
 
+// ------------------------- chained process lists ------------------------ \\
+
+  // one process from a process list, with its argument (if any)
+  struct chain_step {
+    int cmd_no;
+    const char *name;
+    const char *arg;
+  };
+
+  // index of the named process (no_of_cmds if there is none)
+  static int find_cmd(const char *name){
+    int cmd_no = 0;
+    while(cmd_no < no_of_cmds && strcmp(name, cmd_strings[cmd_no])){
+      cmd_no++;
+    }
+    return cmd_no;
+  }
+
+  // check that a pointwise list could be built into one chain
+  static bool valid_pointwise_list(const char *arg){
+    if(arg == NULL){
+      return false;
+    }
+    char list[strlen(arg) + 1];
+    strcpy(list, arg);
+    struct list_entry entries[MAX_CHAIN_LENGTH];
+    int no_entries = split_list(list, entries);
+    struct pointwise_chain scratch;
+    init_pointwise_chain(&scratch);
+    for(int i = 0; i < no_entries; i++){
+      int op_no = find_pointwise_cmd(entries[i].name);
+      if(op_no == no_of_pointwise_cmds || !pointwise_cmds[op_no].add(&scratch, entries[i].arg)){
+        return false;
+      }
+    }
+    return no_entries > 0;
+  }
+
+  // check that a step has the argument its process needs, and that it is in range
+  static bool valid_step(const struct chain_step *step){
+    const char *name = step->name;
+    const char *arg = step->arg;
+    if(!strcmp(name, "rotate") || !strcmp(name, "parallel-rotate")){
+      return arg != NULL && valid_angle(atoi(arg));
+    }
+    if(!strcmp(name, "flip") || !strcmp(name, "parallel-flip")){
+      return arg != NULL && valid_plane(arg[0]);
+    }
+    if(!strcmp(name, "blur")){
+      return arg == NULL || valid_blur_radius(atoi(arg));
+    }
+    if(!strcmp(name, "repeated-blur")){
+      return arg != NULL && valid_blur_passes(atoi(arg));
+    }
+    if(!strcmp(name, "pointwise")){
+      return valid_pointwise_list(arg);
+    }
+    int op_no = find_pointwise_cmd(name);
+    if(op_no != no_of_pointwise_cmds){
+      struct pointwise_chain scratch;
+      init_pointwise_chain(&scratch);
+      return pointwise_cmds[op_no].add(&scratch, arg);
+    }
+    // the remaining processes take no argument
+    return true;
+  }
+
+  /* Split a comma-separated process list (each entry name or name:arg) into
+     steps, checking every name and argument before any work is done. A lone process 
+     without a :arg takes the separate extra argument, as it always has. */
+  static int parse_chain(char *list, const char *extra_arg, struct chain_step *steps){
+    struct list_entry entries[MAX_CHAIN_LENGTH];
+    int no_steps = split_list(list, entries);
+    for(int i = 0; i < no_steps; i++){
+      int cmd_no = find_cmd(entries[i].name);
+      if(cmd_no == no_of_cmds){
+        printf("[!] invalid process requested: %s is not defined\n    aborting...\n", 
+               entries[i].name);
+        exit(IO_ERROR);
+      }
+      steps[i].cmd_no = cmd_no;
+      steps[i].name = entries[i].name;
+      steps[i].arg = entries[i].arg;
+    }
+
+    if(no_steps == 0){
+      printf("[!] no process requested\n");
+      exit(IO_ERROR);
+    }
+    if(extra_arg != NULL){
+      if(no_steps > 1 || steps[0].arg != NULL){
+        printf("[!] extra arg %s is ambiguous in a process list (use name:arg)\n", extra_arg);
+        exit(IO_ERROR);
+      }
+      steps[0].arg = extra_arg;
+    }
+    for(int i = 0; i < no_steps; i++){
+      if(!valid_step(&steps[i])){
+        printf("[!] invalid argument for %s: %s\n    aborting...\n", 
+               steps[i].name, steps[i].arg == NULL ? "(none)" : steps[i].arg);
+        exit(IO_ERROR);
+      }
+    }
+    return no_steps;
+  }
+
+  // run the pointwise processes collected so far as one pass
+  static void flush_pointwise(struct picture *pic, struct pointwise_chain *fused, int *pending){
+    if(*pending > 0){
+      printf("calling pointwise chain (%i processes in one pass)\n", *pending);
+      run_pointwise_chain(pic, fused);
+      init_pointwise_chain(fused);
+      *pending = 0;
+    }
+  }
+
+  // run the 3x3 blurs collected so far (at most MAX_FUSED_BLUR_PASSES) as
+  // one fused pass
+  static void flush_blurs(struct picture *pic, int *blurs){
+    if(*blurs > 0){
+      printf("calling repeated blur (%i)\n", *blurs);
+      repeated_blur_picture(pic, *blurs);
+      *blurs = 0;
+    }
+  }
+
+  /* Run every step on the one decoded picture. Runs of pointwise processes
+     are fused into a single pass and runs of 3x3 blurs into repeated 
+     blurs of at most MAX_FUSED_BLUR_PASSES passes each; a repeated blur 
+     that would not fit runs on its own, and repeated_blur_picture splits it
+     into fused passes. Rotations and flips just update the pending 
+     orientation, and as pointwise processes ignore pixel position they fuse
+     across them. */
+  static void run_chain(struct picture *pic, struct chain_step *steps, int no_steps){
+    struct pointwise_chain fused;
+    init_pointwise_chain(&fused);
+    int pending = 0;
+    int blurs = 0;
+
+    for(int i = 0; i < no_steps; i++){
+      const char *name = steps[i].name;
+      const char *arg = steps[i].arg;
+
+      if(find_pointwise_cmd(name) != no_of_pointwise_cmds){
+        flush_blurs(pic, &blurs);
+        if(fused.length == MAX_POINTWISE_OPS){
+          flush_pointwise(pic, &fused, &pending);
+        }
+        add_pointwise_cmd(pic, &fused, name, arg);
+        pending++;
+        continue;
+      }
+
+      // lazy rotations and flips commute with pointwise processes
+      if(!strcmp(name, "rotate") || !strcmp(name, "flip")){
+        flush_blurs(pic, &blurs);
+        cmds[steps[i].cmd_no](pic, arg);
+        continue;
+      }
+
+      flush_pointwise(pic, &fused, &pending);
+      if(!strcmp(name, "blur") && arg == NULL){
+        blurs++;
+      } else if(!strcmp(name, "repeated-blur") 
+                && atoi(arg) <= MAX_FUSED_BLUR_PASSES - blurs){
+        blurs += atoi(arg);
+      } else {
+        flush_blurs(pic, &blurs);
+        cmds[steps[i].cmd_no](pic, arg);
+      }
+
+      // flush full fused passes straight away, so the count stays bounded
+      if(blurs >= MAX_FUSED_BLUR_PASSES){
+        flush_blurs(pic, &blurs);
+      }
+    }
+
+    flush_pointwise(pic, &fused, &pending);
+    flush_blurs(pic, &blurs);
+  }
+
+  // run a parsed process list on a decoded picture
+  static void run_steps(struct picture *pic, struct chain_step *steps, int no_steps){
+    if(no_steps == 1){
+      cmds[steps[0].cmd_no](pic, steps[0].arg);
+    } else {
+      run_chain(pic, steps, no_steps);
+    }
+  }
+
+// ------------------------------ batch mode ------------------------------ \\
+
+  // environment variable capping the number of pictures decoded at once
+  #define BATCH_IMAGES_ENV "PICTURE_BATCH_IMAGES"
+  // environment variable setting the decoded picture cache budget, in MiB
+  #define BATCH_CACHE_ENV "PICTURE_CACHE_MB"
+  #define DEFAULT_BATCH_CACHE_MB 256
+  #define MAX_MANIFEST_LINE 4096
+
+  // one input picture of a batch and where to save its result
+  struct batch_job {
+    char *input;
+    char *output;
+    bool repeated;    /* Set when the input is listed more than once. */
+    struct chain_step *steps;
+    int no_steps;
+    bool ok;
+  };
+
+  // a growable list of batch jobs
+  struct batch {
+    struct batch_job *jobs;
+    int no_jobs;
+    int capacity;
+  };
+
+  static bool add_batch_job(struct batch *batch, const char *input, const char *output){
+    if(batch->no_jobs == batch->capacity){
+      int capacity = batch->capacity == 0 ? 64 : batch->capacity * 2;
+      struct batch_job *jobs = realloc(batch->jobs, capacity * sizeof(struct batch_job));
+      if(jobs == NULL){
+        return false;
+      }
+      batch->jobs = jobs;
+      batch->capacity = capacity;
+    }
+    struct batch_job *job = &batch->jobs[batch->no_jobs];
+    job->input = strdup(input);
+    job->output = strdup(output);
+    if(job->input == NULL || job->output == NULL){
+      free(job->input);
+      free(job->output);
+      return false;
+    }
+    batch->no_jobs++;
+    return true;
+  }
+
+  // read "input output" pairs, one per line (blank lines and # comments skipped)
+  static bool read_manifest(struct batch *batch, const char *path){
+    FILE *manifest = fopen(path, "r");
+    if(manifest == NULL){
+      printf("[!] could not open batch manifest %s\n", path);
+      return false;
+    }
+    char line[MAX_MANIFEST_LINE];
+    char input[MAX_MANIFEST_LINE];
+    char output[MAX_MANIFEST_LINE];
+    int line_no = 0;
+    bool ok = true;
+    while(ok && fgets(line, sizeof(line), manifest) != NULL){
+      line_no++;
+      char first;
+      if(sscanf(line, " %c", &first) != 1 || first == '#'){
+        continue;
+      }
+      if(sscanf(line, "%s %s", input, output) != 2){
+        printf("[!] %s:%i: expected an input and an output path\n", path, line_no);
+        ok = false;
+      } else {
+        ok = add_batch_job(batch, input, output);
+      }
+    }
+    fclose(manifest);
+    return ok;
+  }
+
+  // check if a file name has a JPEG extension (every output is a JPEG)
+  static bool is_jpeg_name(const char *name){
+    const char *ext = strrchr(name, '.');
+    return ext != NULL && (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg"));
+  }
+
+  // create the output directory if it is not there yet, refusing to write
+  // into the input directory, whose pictures would be overwritten
+  static bool make_output_directory(const char *in_dir, const char *out_dir){
+    struct stat in_info;
+    struct stat out_info;
+    if(stat(in_dir, &in_info) != 0 || !S_ISDIR(in_info.st_mode)){
+      printf("[!] could not open input directory %s\n", in_dir);
+      return false;
+    }
+    if(mkdir(out_dir, 0777) != 0 && errno != EEXIST){
+      printf("[!] could not create output directory %s\n", out_dir);
+      return false;
+    }
+    if(stat(out_dir, &out_info) != 0 || !S_ISDIR(out_info.st_mode)){
+      printf("[!] output %s is not a directory\n", out_dir);
+      return false;
+    }
+    if(in_info.st_dev == out_info.st_dev && in_info.st_ino == out_info.st_ino){
+      printf("[!] output directory %s is the input directory\n", out_dir);
+      return false;
+    }
+    return true;
+  }
+
+  // pair every regular, non-hidden JPEG in in_dir with the same name in out_dir
+  static bool read_directory(struct batch *batch, const char *in_dir, const char *out_dir){
+    if(!make_output_directory(in_dir, out_dir)){
+      return false;
+    }
+    DIR *dir = opendir(in_dir);
+    if(dir == NULL){
+      printf("[!] could not open input directory %s\n", in_dir);
+      return false;
+    }
+    bool ok = true;
+    struct dirent *entry;
+    while(ok && (entry = readdir(dir)) != NULL){
+      if(entry->d_name[0] == '.'){
+        continue;
+      }
+      char input[strlen(in_dir) + strlen(entry->d_name) + 2];
+      char output[strlen(out_dir) + strlen(entry->d_name) + 2];
+      sprintf(input, "%s/%s", in_dir, entry->d_name);
+      sprintf(output, "%s/%s", out_dir, entry->d_name);
+      struct stat info;
+      if(stat(input, &info) != 0 || !S_ISREG(info.st_mode)){
+        continue;
+      }
+      if(!is_jpeg_name(entry->d_name)){
+        printf("[!] batch: skipping %s (not a JPEG)\n", input);
+        continue;
+      }
+      ok = add_batch_job(batch, input, output);
+    }
+    closedir(dir);
+    return ok;
+  }
+
+  // decode, process and encode one picture, reporting (not exiting on) failure
+  static void run_batch_job(void *arg){
+    struct batch_job *job = (struct batch_job *) arg;
+    struct picture pic;
+    // only an input that is listed again is worth keeping decoded
+    bool loaded = job->repeated ? init_cached_picture_from_file(&pic, job->input)
+                                : init_picture_from_file(&pic, job->input);
+    if(!loaded){
+      printf("[!] batch: could not load %s\n", job->input);
+      return;
+    }
+    run_steps(&pic, job->steps, job->no_steps);
+    materialise_picture(&pic);
+    job->ok = save_picture_to_file(&pic, job->output);
+    if(!job->ok){
+      printf("[!] batch: could not save %s\n", job->output);
+    }
+    clear_picture(&pic);
+  }
+
+  // bytes of decoded pictures to keep for inputs that appear more than once
+  static size_t batch_cache_budget(void){
+    const char *budget = getenv(BATCH_CACHE_ENV);
+    long mib = budget != NULL ? atol(budget) : DEFAULT_BATCH_CACHE_MB;
+    return mib > 0 ? (size_t) mib << 20 : 0;
+  }
+
+  static int compare_job_inputs(const void *a, const void *b){
+    const struct batch_job *job_a = *(struct batch_job * const *) a;
+    const struct batch_job *job_b = *(struct batch_job * const *) b;
+    return strcmp(job_a->input, job_b->input);
+  }
+
+  // mark the jobs whose input is listed more than once, by sorting the inputs
+  static void mark_repeated_inputs(struct batch *batch){
+    struct batch_job **sorted = malloc(batch->no_jobs * sizeof(struct batch_job *));
+    if(sorted == NULL){
+      return;
+    }
+    for(int i = 0; i < batch->no_jobs; i++){
+      sorted[i] = &batch->jobs[i];
+    }
+    qsort(sorted, batch->no_jobs, sizeof(struct batch_job *), compare_job_inputs);
+    for(int i = 1; i < batch->no_jobs; i++){
+      if(!strcmp(sorted[i - 1]->input, sorted[i]->input)){
+        sorted[i - 1]->repeated = true;
+        sorted[i]->repeated = true;
+      }
+    }
+    free(sorted);
+  }
+
+  // number of pictures that may be decoded at once (at least 1)
+  static int batch_images(void){
+    const char *cap = getenv(BATCH_IMAGES_ENV);
+    int images = cap != NULL ? atoi(cap) : available_cpus();
+    return images > 0 ? images : 1;
+  }
+
+  /* Run one process list over every picture of a batch. The list has been 
+     checked by parse_chain, so a bad process or argument stops the batch 
+     before any file is touched; after that only loading or saving a file 
+     can fail, which is reported and counted without stopping the rest.
+     Pictures are handled by a dedicated pool (each one still tiles its 
+     work onto the shared pool), and as the thread waiting on the batch 
+     also takes pictures, the pool has one thread fewer than the number of 
+     pictures allowed to be decoded at once. Inputs listed more than once
+     are decoded once while they stay in the picture cache; any other input
+     bypasses the cache, so it is neither held in memory nor copied before
+     it is modified. */
+  static int run_batch(struct batch *batch, struct chain_step *steps, int no_steps){
+    for(int i = 0; i < batch->no_jobs; i++){
+      batch->jobs[i].steps = steps;
+      batch->jobs[i].no_steps = no_steps;
+      batch->jobs[i].ok = false;
+      batch->jobs[i].repeated = false;
+    }
+    mark_repeated_inputs(batch);
+
+    set_picture_cache_budget(batch_cache_budget());
+    struct t_pool pool;
+    int workers = batch_images() - 1;
+    bool pooled = workers > 0 && thread_pool_init(&pool, workers);
+    if(pooled){
+      struct t_group group;
+      task_group_init(&group);
+      for(int i = 0; i < batch->no_jobs; i++){
+        thread_pool_submit(&pool, &group, run_batch_job, &batch->jobs[i]);
+      }
+      thread_pool_wait(&pool, &group);
+      task_group_destroy(&group);
+      thread_pool_destroy(&pool);
+    } else {
+      for(int i = 0; i < batch->no_jobs; i++){
+        run_batch_job(&batch->jobs[i]);
+      }
+    }
+
+    // report the outcome and clean up
+    clear_picture_cache();
+    int done = 0;
+    for(int i = 0; i < batch->no_jobs; i++){
+      done += batch->jobs[i].ok;
+      free(batch->jobs[i].input);
+      free(batch->jobs[i].output);
+    }
+    printf("-- batch complete: %i of %i pictures processed --\n", done, batch->no_jobs);
+    int failed = batch->no_jobs - done;
+    free(batch->jobs);
+    return failed == 0 ? 0 : IO_ERROR;
+  }
+
+  /* Batch mode entry point, for either
+       --batch <manifest> <process> [extra arg]
+       --batch-dir <input dir> <output dir> <process> [extra arg] */
+  static int batch_main(int argc, char **argv){
+    bool from_dir = !strcmp(argv[1], "--batch-dir");
+    int process_arg = from_dir ? 4 : 3;
+    if(argc <= process_arg){
+      printf("[!] insufficient command line arguments provided\n");
+      exit(IO_ERROR);
+    }
+    const char *process = argv[process_arg];
+    const char *extra_arg = argv[process_arg + 1];
+
+    // check the process list before reading any inputs
+    struct chain_step steps[MAX_CHAIN_LENGTH];
+    char list[strlen(process) + 1];
+    strcpy(list, process);
+    int no_steps = parse_chain(list, extra_arg, steps);
+
+    struct batch batch = {NULL, 0, 0};
+    bool listed = from_dir ? read_directory(&batch, argv[2], argv[3])
+                           : read_manifest(&batch, argv[2]);
+    if(!listed){
+      exit(IO_ERROR);
+    }
+    return run_batch(&batch, steps, no_steps);
+  }
+
 // ---------- MAIN PROGRAM ---------- \\
 
   int main(int argc, char **argv){
 
     printf("Running the C Picture Processor... \n");
 
+    // many pictures at once
+    if(argc > 1 && (!strcmp(argv[1], "--batch") || !strcmp(argv[1], "--batch-dir"))){
+      return batch_main(argc, argv);
+    }
+
     // capture and check command line arguments
     const char * filename = argv[1];
     const char * target_file = argv[2];
@@ -89,30 +803,28 @@
   
     printf("\n");
   
+    // identify the picture transformation(s) to run
+    struct chain_step steps[MAX_CHAIN_LENGTH];
+    char list[strlen(process) + 1];
+    strcpy(list, process);
+    int no_steps = parse_chain(list, extra_arg, steps);
+
     // create original image object
     struct picture pic;
     if(!init_picture_from_file(&pic, filename)){
       exit(IO_ERROR);   
     }    
   
-    // identify the picture transformation to run
-    int cmd_no = 0;
-    while(cmd_no < no_of_cmds && strcmp(process, cmd_strings[cmd_no])){
-      cmd_no++;
-    }
-  
-    // IO error check
-    if(cmd_no == no_of_cmds){
-      printf("[!] invalid process requested: %s is not defined\n    aborting...\n", process);  
-      clear_picture(&pic);
-      exit(IO_ERROR);   
-    }
-  
-    // dispatch to appropriate picture transformation function
-    cmds[cmd_no](&pic, extra_arg);
+    // decode once, run every transformation in memory, then encode once
+    run_steps(&pic, steps, no_steps);
 
     // save resulting picture and report success
-    save_picture_to_file(&pic, target_file);
+    materialise_picture(&pic);
+    if(!save_picture_to_file(&pic, target_file)){
+      printf("[!] could not save picture to %s\n", target_file);
+      clear_picture(&pic);
+      exit(IO_ERROR);
+    }
     printf("-- picture processing complete --\n");
     
     clear_picture(&pic);
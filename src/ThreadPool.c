@@ -1,105 +1,195 @@
 #define _GNU_SOURCE
 #define __USE_GNU
 #include "ThreadPool.h"
+#include <sched.h>
+#include <unistd.h>
 
-// Initalise a thread pool by assigning basic members
-bool thread_pool_init(struct t_pool *pool) {
-    pool->head = (struct node*) malloc(sizeof(struct node));
-    pool->tail = (struct node*) malloc(sizeof(struct node));
+static void *worker_loop(void *arg);
+static struct task *dequeue_task(struct t_pool *pool);
+static void run_task(struct t_pool *pool, struct task *task);
 
-    // Check that neither malloc failed and exit if any did
-    if (pool->head == NULL || pool->tail == NULL) {
-        return false;
+static struct t_pool shared_pool;
+static pthread_once_t shared_pool_once = PTHREAD_ONCE_INIT;
+
+// Count the CPUs this process is allowed to run on
+int available_cpus(void) {
+    cpu_set_t set;
+
+    // Respect the affinity mask (taskset, cgroups) before the machine total
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        return CPU_COUNT(&set);
     }
 
-    /* Return a linked list with a head, a tail and no other nodes
-       Ensure that the head can have no node before it and the tail
-       can have no node after. */
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int) online : 1;
+}
 
-    pool->head->prev = NULL;
-    pool->head->next = pool->tail;
-    pool->tail->prev = pool->head;
-    pool->tail->next = NULL;
+// Initialise a thread pool and start its worker threads
+bool thread_pool_init(struct t_pool *pool, int no_threads) {
+    pool->threads = (pthread_t*) malloc(no_threads * sizeof(pthread_t));
 
+    // Check that malloc has not failed and exit if it has
+    if (pool->threads == NULL) {
+        return false;
+    }
+
+    pool->no_threads = 0;
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->shutdown = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+
+    // Start the workers, keeping however many could be created
+    for (int i = 0; i < no_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_loop, pool) != 0) {
+            break;
+        }
+        pool->no_threads++;
+    }
+
+    if (pool->no_threads == 0) {
+        thread_pool_destroy(pool);
+        return false;
+    }
     return true;
 }
 
-// Create a new node and assign its thread to the thread passed in
-struct node *create_node(pthread_t thread) {
-    struct node *node = (struct node*) malloc(sizeof(struct node));
+// Finish all queued tasks, then stop and join the worker threads
+void thread_pool_destroy(struct t_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
 
-    // Check that malloc has not failed and return a NULL node if it has
-    if (node == NULL) {
-        return NULL;
+    for (int i = 0; i < pool->no_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
     }
 
-    node->thread = thread;
-    return node;
+    // Free resources
+    free(pool->threads);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
 }
 
-// Remove a specified node from the thread pool
-void remove_node(struct node *node) {
+static void init_shared_pool(void) {
+    if (!thread_pool_init(&shared_pool, available_cpus())) {
+        // Without workers every task is run by the thread waiting on it
+        shared_pool.threads = NULL;
+        shared_pool.no_threads = 0;
+        shared_pool.head = NULL;
+        shared_pool.tail = NULL;
+        shared_pool.shutdown = false;
+        pthread_mutex_init(&shared_pool.lock, NULL);
+        pthread_cond_init(&shared_pool.work, NULL);
+    }
+}
 
-    // Assign the previous node's next node to the current node's next node
-    node->prev->next = node->next;
+// Get the process-wide pool, starting its workers on first use
+struct t_pool *shared_thread_pool(void) {
+    pthread_once(&shared_pool_once, init_shared_pool);
+    return &shared_pool;
+}
 
-    // Assign the next node's previous node to the current node's previous node
-    node->next->prev = node->prev;
+void task_group_init(struct t_group *group) {
+    group->pending = 0;
+    pthread_cond_init(&group->done, NULL);
 }
 
-// Add a thread to a thread pool
-bool add_thread_to_pool(pthread_t thread, struct t_pool *pool) {
-    struct node *node = create_node(thread);
+void task_group_destroy(struct t_group *group) {
+    pthread_cond_destroy(&group->done);
+}
 
-    // Check if the node is null (malloc failed)
-    if (node == NULL) {
-        return false;
+// Queue a task on the pool, counting it against group (if given)
+void thread_pool_submit(struct t_pool *pool, struct t_group *group,
+                        void (*fn)(void *), void *arg) {
+    struct task *task = (struct task*) malloc(sizeof(struct task));
+
+    // Check if malloc failed and run the task on the calling thread instead
+    if (task == NULL) {
+        fn(arg);
+        return;
     }
 
-    // Add node containing thread to the back of the list
-    pool->tail->prev->next = node;
-    node->prev = pool->tail->prev;
-    node->next = pool->tail;
-    pool->tail->prev = node;
+    task->next = NULL;
+    task->fn = fn;
+    task->arg = arg;
+    task->group = group;
 
-    return true;
+    pthread_mutex_lock(&pool->lock);
+    if (group != NULL) {
+        group->pending++;
+    }
+
+    // Add task to the back of the queue
+    if (pool->tail == NULL) {
+        pool->head = task;
+    } else {
+        pool->tail->next = task;
+    }
+    pool->tail = task;
+
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
 }
 
+/* Block until every task in group has finished. The waiting thread runs
+   queued tasks itself rather than sleeping, so waiting from inside a pool
+   task (nested parallelism) cannot starve the pool. */
+void thread_pool_wait(struct t_pool *pool, struct t_group *group) {
+    pthread_mutex_lock(&pool->lock);
+    while (group->pending > 0) {
+        if (pool->head != NULL) {
+            run_task(pool, dequeue_task(pool));
+        } else {
+            pthread_cond_wait(&group->done, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
 
-void threads_join(struct t_pool *pool) {
-    struct node *prev = NULL;
-    struct node *curr = pool->head;
+// Take the task at the front of the queue (pool lock must be held)
+static struct task *dequeue_task(struct t_pool *pool) {
+    struct task *task = pool->head;
 
-    // Iterate through all threads until hitting a NULL
-    while (curr != NULL) {
-        prev = curr;
-        curr = curr->next;
+    pool->head = task->next;
+    if (pool->head == NULL) {
+        pool->tail = NULL;
+    }
+    return task;
+}
 
-        // The current node being checked is not the head or tail  
-        if (prev != pool->head && prev != pool->tail) {
-            // Waits for a thread to terminate and then detaches the thread
-            pthread_join(prev->thread, NULL);
-        }
+// Run a task outside the pool lock and report its completion to its group
+static void run_task(struct t_pool *pool, struct task *task) {
+    pthread_mutex_unlock(&pool->lock);
+    task->fn(task->arg);
+    pthread_mutex_lock(&pool->lock);
 
-        // Free resources
-        free(prev);
+    if (task->group != NULL && --task->group->pending == 0) {
+        pthread_cond_broadcast(&task->group->done);
     }
+
+    // Free resources
+    free(task);
 }
 
-void tryjoin_threads(struct t_pool *pool) {
-    struct node *prev = NULL;
-    struct node *curr = pool->head->next;
+// Main loop of each worker: run tasks until the pool shuts down
+static void *worker_loop(void *arg) {
+    struct t_pool *pool = (struct t_pool*) arg;
 
-    // Iterate through all nodes in the pool
-    while (curr != pool->tail) {
-        prev = curr;
-        curr = curr->next;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->head == NULL && !pool->shutdown) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
 
-        // Perform a join and check thread's successful termination
-        if (pthread_tryjoin_np(prev->thread, NULL) == 0) {
-            //Remove the current node being checked from the pool and free it
-            remove_node(prev);
-            free(prev);
+        // Only stop once the queue has been drained
+        if (pool->head == NULL) {
+            break;
         }
+        run_task(pool, dequeue_task(pool));
     }
-} 
\ No newline at end of file
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
@@ -1,24 +1,45 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
 #define _GNU_SOURCE
 #define __USE_GNU
 #include <stdlib.h>
 #include <pthread.h>
 #include <stdbool.h>
 
-// Represents a thread pool using a linked-list as a medium
-struct t_pool {
-    struct node *head; /* Head of the linked list. */
-    struct node *tail; /* Tail of the linked list. */
+// A unit of work waiting in a thread pool's queue
+struct task {
+    struct task *next;       /* Next task in the queue. */
+    void (*fn)(void *arg);   /* Work to run on a pool thread. */
+    void *arg;               /* Argument passed to fn. */
+    struct t_group *group;   /* Group notified on completion (may be NULL). */
+};
+
+// Tracks a batch of submitted tasks so that the submitter can wait for them
+struct t_group {
+    int pending;             /* Tasks submitted but not yet finished. */
+    pthread_cond_t done;     /* Signalled when pending drops to zero. */
 };
 
-struct node {
-    struct node *prev; /* Previous node in the linked list. */
-    struct node *next; /* Next node in the linked list. */
-    pthread_t thread;  /* Thread beloning to the current node. */
+// Represents a fixed-size pool of long-lived worker threads fed by a queue
+struct t_pool {
+    pthread_t *threads;      /* Worker threads owned by the pool. */
+    int no_threads;          /* Number of worker threads. */
+    struct task *head;       /* Next task to be run. */
+    struct task *tail;       /* Most recently queued task. */
+    pthread_mutex_t lock;    /* Guards the queue, groups and shutdown flag. */
+    pthread_cond_t work;     /* Signalled when a task is queued or on shutdown. */
+    bool shutdown;           /* Set once the pool is being torn down. */
 };
 
-bool thread_pool_init(struct t_pool *pool);
-struct node *create_node(pthread_t thread);
-void remove_node(struct node *node);
-bool add_thread_to_pool(pthread_t thread, struct t_pool *pool);
-void threads_join(struct t_pool *pool);
-void tryjoin_threads(struct t_pool *pool);
\ No newline at end of file
+int available_cpus(void);
+bool thread_pool_init(struct t_pool *pool, int no_threads);
+void thread_pool_destroy(struct t_pool *pool);
+struct t_pool *shared_thread_pool(void);
+void task_group_init(struct t_group *group);
+void task_group_destroy(struct t_group *group);
+void thread_pool_submit(struct t_pool *pool, struct t_group *group,
+                        void (*fn)(void *), void *arg);
+void thread_pool_wait(struct t_pool *pool, struct t_group *group);
+
+#endif
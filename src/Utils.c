@@ -1,5 +1,6 @@
 #include "Utils.h"
 #include <unistd.h>
+#include <string.h>
 
   #define DEFAULT_COMPRESSION_QUALITY -1
   #define FULL_COLOUR_CHANNELS 3
@@ -35,6 +36,34 @@
     return true;
   }
 
+  bool save_pixels(const unsigned char *pixels, int width, int height, 
+                   int stride, const char *path){
+    // the encoder expects tightly packed rows
+    const unsigned char *packed = pixels;
+    unsigned char *tmp = NULL;
+    if(stride != width * FULL_COLOUR_CHANNELS){
+      tmp = malloc((size_t) width * height * FULL_COLOUR_CHANNELS);
+      if(tmp == NULL){
+        printf("[!] error saving file to %s\n", path);
+        return false;
+      }
+      for(int y = 0; y < height; y++){
+        memcpy(tmp + (size_t) y * width * FULL_COLOUR_CHANNELS,
+               pixels + (size_t) y * stride, width * FULL_COLOUR_CHANNELS);
+      }
+      packed = tmp;
+    }
+
+    int ret = sod_img_blob_save_as_jpeg(path, packed, width, height,
+                FULL_COLOUR_CHANNELS, DEFAULT_COMPRESSION_QUALITY);
+    free(tmp);
+    if(ret != SOD_OK){
+      printf("[!] error saving file to %s\n", path);
+      return false;
+    }
+    return true;
+  }
+
   sod_img copy_image(sod_img img){
     return sod_copy_image(img);   
   }
@@ -53,6 +82,23 @@
     return rgb_value;
   }
 
+  void export_image_pixels(sod_img img, unsigned char *pixels, int stride){
+    int plane = img.w * img.h;
+    for(int y = 0; y < img.h; y++){
+      unsigned char *row = pixels + (size_t) y * stride;
+      for(int x = 0; x < img.w; x++){
+        for(int rgb = 0; rgb < FULL_COLOUR_CHANNELS; rgb++){
+          // channels missing from the image read as 0, as in sod_img_get_pixel
+          int rgb_value = 0;
+          if(rgb < img.c){
+            rgb_value = img.data[rgb * plane + y * img.w + x] * MAX_PIXEL_INTENSITY;
+          }
+          row[x * FULL_COLOUR_CHANNELS + rgb] = rgb_value;
+        }
+      }
+    }
+  }
+
   void set_pixel_value(sod_img img, int rgb, int x, int y, int val){
     float intensity = val / MAX_PIXEL_INTENSITY;  
     sod_img_set_pixel(img, x, y, rgb, intensity);  
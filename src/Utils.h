@@ -22,6 +22,11 @@
   // Saves the given image in the given destination.
   bool save_image(sod_img img, const char *path);
     
+  // Saves packed 8-bit RGB pixel data, stride bytes per row, as a JPEG in 
+  // the given destination.
+  bool save_pixels(const unsigned char *pixels, int width, int height, 
+                   int stride, const char *path);
+    
   // Clones the image provided as argument
   sod_img copy_image(sod_img img);
   
@@ -35,6 +40,10 @@
   // NOTE: (rgb = 0 for red, rgb = 1 for green, rgb = 2 for blue)
   int get_pixel_value(sod_img img, int rgb, int x, int y);
   
+  // Copy every pixel of the image into a packed 8-bit RGB buffer with rows 
+  // stride bytes apart, converting intensities as get_pixel_value does
+  void export_image_pixels(sod_img img, unsigned char *pixels, int stride);
+  
   // Set the R/G/B pixel intensity for pixel at (x,y)
   // NOTE: (rgb = 0 for red, rgb = 1 for green, rgb = 2 for blue)
   void set_pixel_value(sod_img img, int rgb, int x, int y, int val);